@@ -10,184 +10,5903 @@
 #include <memory>
 #include <ctime>
 #include <cstdlib>
+#include <cstdint>
+#include <functional>
+#include <algorithm>
+#include <iomanip>
+#include <cmath>
+#include <atomic>
+#include <stdexcept>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <bit>
+#include <array>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <fstream>
+#include <sstream>
+#include <barrier>
+#include <span>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+#include <coroutine>
+#include <utility>
+#include <numeric>
+#include <climits>
+#include <deque>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <csignal>
+#endif
 
 using namespace std;
 
 // Forward declarations
 class Building;
 class Elevator;
+class CarScheduler;
+struct CarTask;
+
+// Simulation time shares steady_clock's representation so both clock modes
+// can stamp requests and measure latency the same way
+using SimTime = chrono::steady_clock::time_point;
+using SimDuration = chrono::steady_clock::duration;
+
+const SimDuration floorTravelTime = chrono::milliseconds(200);
+// Estimated delay each queued stop adds to a car's arrival elsewhere
+const SimDuration stopPenalty = floorTravelTime;
+
+// Clock interface: every timestamp and delay in the simulation goes through it
+class SimClock {
+public:
+    virtual ~SimClock() = default;
+    virtual SimTime now() const = 0;
+    virtual void sleepFor(SimDuration d) = 0;
+};
+
+// Wall-clock time, used by the threaded demo mode
+class RealTimeClock : public SimClock {
+public:
+    SimTime now() const override { return chrono::steady_clock::now(); }
+    void sleepFor(SimDuration d) override { this_thread::sleep_for(d); }
+};
+
+// Virtual time, owned by a single thread (the event loop) and never blocking
+class VirtualClock : public SimClock {
+private:
+    SimTime current{};
+
+public:
+    SimTime now() const override { return current; }
+    void sleepFor(SimDuration d) override { current += d; }
+    void advanceTo(SimTime t) { current = t; }
+};
 
 // Request structure
 struct Request {
     int sourceFloor;
     int destFloor;
-    chrono::steady_clock::time_point timestamp;
+    SimTime timestamp;
+    uint32_t tag = 0; // caller's id for the call, handed back at drop-off
+    uint32_t id = 0;  // the building's arrival number, from 1; ties a call's events together in the EventLog
+
+    int direction() const { return destFloor > sourceFloor ? 1 : -1; }
+};
+
+// Flat binary checkpoint encoding. Each object appends its state as raw
+// trivially-copyable values in a fixed order and reads it back in the same
+// order. Host byte order: a snapshot resumes on the machine that wrote it.
+class SnapshotWriter {
+private:
+    vector<uint8_t> bytes;
+
+public:
+    template <typename T>
+    void put(const T& v) {
+        static_assert(is_trivially_copyable_v<T>);
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(&v);
+        bytes.insert(bytes.end(), p, p + sizeof(T));
+    }
+
+    // Element count, then the elements
+    template <typename C>
+    void putAll(const C& items) {
+        put<uint64_t>(items.size());
+        for (const auto& v : items) put(v);
+    }
+
+    const vector<uint8_t>& data() const { return bytes; }
+};
+
+// Reads a SnapshotWriter's encoding in place, e.g. straight from a mapped file
+class SnapshotReader {
+private:
+    const uint8_t* p;
+    const uint8_t* end;
+
+public:
+    SnapshotReader(const void* data, size_t size)
+        : p(static_cast<const uint8_t*>(data)), end(static_cast<const uint8_t*>(data) + size) {}
+
+    template <typename T>
+    T get() {
+        static_assert(is_trivially_copyable_v<T>);
+        if (static_cast<size_t>(end - p) < sizeof(T)) throw runtime_error("snapshot is truncated");
+        T v;
+        memcpy(&v, p, sizeof(T));
+        p += sizeof(T);
+        return v;
+    }
+
+    // Appends what putAll wrote
+    template <typename T, typename C>
+    void getAll(C& out) {
+        uint64_t n = get<uint64_t>();
+        if (n > static_cast<size_t>(end - p) / sizeof(T)) throw runtime_error("snapshot is truncated");
+        for (uint64_t i = 0; i < n; i++) out.push_back(get<T>());
+    }
+
+    bool atEnd() const { return p == end; }
+};
+
+// Every restore path takes calls through here, so a snapshot never routes a car off the building
+void checkSnapshotCall(int sourceFloor, int destFloor, int floors) {
+    if (sourceFloor < 1 || sourceFloor > floors || destFloor < 1 || destFloor > floors) {
+        throw runtime_error("snapshot has a call off the building");
+    }
+}
+
+// How cars take work from the building queue
+enum class DispatchMode {
+    Fifo, // one request per trip, in arrival order
+    Scan, // LOOK: keep a direction and pick up every compatible call on the way
+    Eta,  // the building routes each call to the car with the lowest estimated pickup time
+    Destination, // calls from one floor to the same destination band share a car
+};
+
+// Where FIFO and SCAN requests wait until a car takes them (ETA and
+// destination dispatch always use per-car queues)
+enum class QueueMode {
+    Shared, // one building-wide queue behind Building::mtx
+    Local,  // each car owns a deque for its floor band; idle cars steal from neighbours
+    LockFree, // bounded lock-free ring shared by all cars (FIFO only: calls can't be claimed mid-queue)
+};
+
+// Process-wide count of operator new calls, reported with each run so the
+// hot path can be checked for allocations. Kept out of line so GCC doesn't
+// pair an inlined malloc/free with the builtin new/delete.
+atomic<uint64_t> heapAllocations{ 0 };
+
+[[gnu::noinline]] void* operator new(size_t n) {
+    heapAllocations.fetch_add(1, memory_order_relaxed);
+    if (void* p = malloc(n ? n : 1)) return p;
+    throw bad_alloc();
+}
+
+[[gnu::noinline]] void operator delete(void* p) noexcept { free(p); }
+[[gnu::noinline]] void operator delete(void* p, size_t) noexcept { free(p); }
+
+// Free-list pool with power-of-two size classes carved out of 64 KB slabs.
+// Freed blocks go back on their class's list instead of to the heap, so a
+// container that has reached its working size stops allocating; the slabs
+// are released together when the pool is destroyed at the end of a run.
+// Not thread-safe: each pool is only used by one thread or under one lock.
+class SlabPool {
+private:
+    static constexpr size_t slabBytes = 64 * 1024;
+    static constexpr size_t minBlock = 16;
+    static constexpr int classCount = 24;
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    array<FreeBlock*, classCount> freeLists{};
+    vector<unique_ptr<byte[]>> slabs;
+    byte* cursor = nullptr;
+    size_t left = 0;
+
+    static int classOf(size_t n) {
+        return n <= minBlock ? 0 : bit_width(n - 1) - bit_width(minBlock - 1);
+    }
+
+public:
+    SlabPool() = default;
+    SlabPool(const SlabPool&) = delete;
+    SlabPool& operator=(const SlabPool&) = delete;
+
+    void* allocate(size_t n) {
+        int c = classOf(n);
+        if (c >= classCount) return ::operator new(n);
+        if (FreeBlock* b = freeLists[c]) {
+            freeLists[c] = b->next;
+            return b;
+        }
+        size_t size = minBlock << c;
+        if (size > left) {
+            size_t slab = max(slabBytes, size);
+            slabs.push_back(make_unique<byte[]>(slab));
+            cursor = slabs.back().get();
+            left = slab;
+        }
+        void* p = cursor;
+        cursor += size;
+        left -= size;
+        return p;
+    }
+
+    void deallocate(void* p, size_t n) {
+        int c = classOf(n);
+        if (c >= classCount) {
+            ::operator delete(p);
+            return;
+        }
+        auto* b = static_cast<FreeBlock*>(p);
+        b->next = freeLists[c];
+        freeLists[c] = b;
+    }
+};
+
+// Standard allocator over a SlabPool; containers sharing a pool compare equal
+template <typename T>
+struct PoolAllocator {
+    using value_type = T;
+
+    SlabPool* pool;
+
+    explicit PoolAllocator(SlabPool& p) : pool(&p) {}
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>& o) : pool(o.pool) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(pool->allocate(n * sizeof(T))); }
+    void deallocate(T* p, size_t n) { pool->deallocate(p, n * sizeof(T)); }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U>& o) const { return pool == o.pool; }
+};
+
+template <typename T>
+using PoolVector = vector<T, PoolAllocator<T>>;
+
+const size_t requestRingCapacity = 1 << 16;
+const int wakeSpinCount = 200; // polls before a waiting car blocks on the wake counter
+
+// Waiting hall calls indexed by floor and direction. Each call sits on two
+// intrusive lists threaded through one node array: the age list keeps
+// arrival order for FIFO takes (oldest first) and steals (newest first), and
+// its floor/direction bucket holds the calls a passing car can board. A
+// bitmap per direction marks the non-empty buckets, so whether anyone waits
+// at a floor is one bit test rather than a walk over the whole queue.
+// Not thread-safe: guarded by the owner's lock, like the pool it draws on.
+class HallCallQueue {
+private:
+    static constexpr int32_t none = -1;
+
+    struct Node {
+        Request request;
+        uint64_t seq; // arrival order, to pick the older of a floor's two buckets
+        int32_t older, newer; // age list; newer doubles as the free-list link
+        int32_t olderHere, newerHere; // bucket list
+    };
+
+    int floors;
+    PoolVector<Node> nodes;
+    int32_t freeList = none;
+    int32_t oldest = none, newest = none;
+    PoolVector<int32_t> bucketOldest, bucketNewest; // by bucketOf
+    PoolVector<uint32_t> bucketSize;
+    PoolVector<uint64_t> waitingUp, waitingDown; // one bit per floor
+    size_t count = 0;
+    uint64_t nextSeq = 0;
+
+    static size_t bucketOf(int floor, int dir) { return static_cast<size_t>(floor) * 2 + (dir > 0); }
+
+    PoolVector<uint64_t>& bitsFor(int dir) { return dir > 0 ? waitingUp : waitingDown; }
+
+    Request remove(int32_t n) {
+        Node& node = nodes[n];
+        (node.older != none ? nodes[node.older].newer : oldest) = node.newer;
+        (node.newer != none ? nodes[node.newer].older : newest) = node.older;
+        int floor = node.request.sourceFloor, dir = node.request.direction();
+        size_t b = bucketOf(floor, dir);
+        (node.olderHere != none ? nodes[node.olderHere].newerHere : bucketOldest[b]) = node.newerHere;
+        (node.newerHere != none ? nodes[node.newerHere].olderHere : bucketNewest[b]) = node.olderHere;
+        if (--bucketSize[b] == 0) bitsFor(dir)[floor / 64] &= ~(uint64_t(1) << (floor % 64));
+        node.newer = freeList;
+        freeList = n;
+        count--;
+        return node.request;
+    }
+
+public:
+    HallCallQueue(int floors, SlabPool& pool)
+        : floors(floors), nodes(PoolAllocator<Node>(pool)),
+          bucketOldest(bucketOf(floors + 1, 0), none, PoolAllocator<int32_t>(pool)),
+          bucketNewest(bucketOf(floors + 1, 0), none, PoolAllocator<int32_t>(pool)),
+          bucketSize(bucketOf(floors + 1, 0), 0, PoolAllocator<uint32_t>(pool)),
+          waitingUp(floors / 64 + 1, 0, PoolAllocator<uint64_t>(pool)),
+          waitingDown(floors / 64 + 1, 0, PoolAllocator<uint64_t>(pool)) {}
+
+    bool empty() const { return count == 0; }
+    size_t size() const { return count; }
+
+    void push(const Request& r) {
+        int32_t n = freeList;
+        if (n != none) freeList = nodes[n].newer;
+        else {
+            n = static_cast<int32_t>(nodes.size());
+            nodes.emplace_back();
+        }
+        int floor = r.sourceFloor, dir = r.direction();
+        size_t b = bucketOf(floor, dir);
+        nodes[n] = { r, nextSeq++, newest, none, bucketNewest[b], none };
+        (newest != none ? nodes[newest].newer : oldest) = n;
+        newest = n;
+        (bucketNewest[b] != none ? nodes[bucketNewest[b]].newerHere : bucketOldest[b]) = n;
+        bucketNewest[b] = n;
+        if (bucketSize[b]++ == 0) bitsFor(dir)[floor / 64] |= uint64_t(1) << (floor % 64);
+        count++;
+    }
+
+    optional<Request> popOldest() {
+        if (oldest == none) return nullopt;
+        return remove(oldest);
+    }
+
+    optional<Request> popNewest() {
+        if (newest == none) return nullopt;
+        return remove(newest);
+    }
+
+    bool callsAt(int floor, int dir) const {
+        const auto& bits = dir > 0 ? waitingUp : waitingDown;
+        return bits[floor / 64] >> (floor % 64) & 1;
+    }
+
+    // Nearest floor past `from` and up to `limit` with a call heading in
+    // dir, or `limit` if there is none: a word at a time over the bitmap
+    int nextCall(int from, int dir, int limit) const {
+        const auto& bits = dir > 0 ? waitingUp : waitingDown;
+        if (dir > 0) {
+            for (int f = from + 1; f < limit;) {
+                uint64_t word = bits[f / 64] >> (f % 64);
+                if (word) return min(limit, f + countr_zero(word));
+                f += 64 - f % 64;
+            }
+        }
+        else {
+            for (int f = from - 1; f > limit;) {
+                uint64_t word = bits[f / 64] << (63 - f % 64);
+                if (word) return max(limit, f - countl_zero(word));
+                f -= f % 64 + 1;
+            }
+        }
+        return limit;
+    }
+
+    // Moves up to `room` calls waiting at `floor` heading in `dir`, oldest
+    // first, to claimed and returns how many had to stay behind. With
+    // dir == 0 the direction of the oldest call at that floor is used.
+    size_t claim(int floor, int dir, size_t room, PoolVector<Request>& claimed) {
+        if (dir == 0) {
+            int32_t up = bucketOldest[bucketOf(floor, 1)], down = bucketOldest[bucketOf(floor, -1)];
+            if (up == none && down == none) return 0;
+            dir = down == none || (up != none && nodes[up].seq < nodes[down].seq) ? 1 : -1;
+        }
+        if (!callsAt(floor, dir)) return 0;
+        size_t b = bucketOf(floor, dir);
+        for (; room > 0 && bucketOldest[b] != none; room--) claimed.push_back(remove(bucketOldest[b]));
+        return bucketSize[b];
+    }
+
+    // Removes every call, handing each to fn oldest first
+    template <typename Fn>
+    void drain(Fn fn) {
+        while (oldest != none) fn(remove(oldest));
+    }
+
+    // Same encoding as SnapshotWriter::putAll over the calls in arrival order
+    void save(SnapshotWriter& w) const {
+        w.put<uint64_t>(count);
+        for (int32_t n = oldest; n != none; n = nodes[n].newer) w.put(nodes[n].request);
+    }
+
+    // Appends the saved calls
+    void restore(SnapshotReader& r) {
+        for (uint64_t n = r.get<uint64_t>(); n > 0; n--) {
+            Request q = r.get<Request>();
+            checkSnapshotCall(q.sourceFloor, q.destFloor, floors);
+            push(q);
+        }
+    }
+};
+
+// A passenger on board and when they got in
+struct Rider {
+    Request request;
+    SimTime boardedAt;
+};
+
+// Log-linear (HDR-style) histogram of durations in microseconds: values below
+// subBucketCount are exact, above that every power-of-two range is split into
+// subBucketCount/2 buckets, so the relative error stays under 1/64.
+// One thread records with relaxed atomics; readers may merge at any time.
+// Buckets are allocated one power-of-two range (chunk) at a time on first
+// use, so a histogram only pays for the magnitudes it actually sees.
+class LatencyHistogram {
+private:
+    static constexpr int subBucketBits = 7;
+    static constexpr uint64_t subBucketCount = 1 << subBucketBits;
+    static constexpr uint64_t halfCount = subBucketCount / 2;
+    static constexpr size_t bucketCount = subBucketCount + (64 - subBucketBits) * halfCount;
+    static constexpr size_t chunkCount = 1 + 64 - subBucketBits; // chunk 0 holds the exact range
+
+    array<atomic<atomic<uint64_t>*>, chunkCount> chunks{};
+    atomic<uint64_t> total{ 0 };
+    atomic<uint64_t> sumMicros{ 0 };
+    atomic<uint64_t> maxMicros{ 0 };
+
+    static size_t indexOf(uint64_t v) {
+        if (v < subBucketCount) return static_cast<size_t>(v);
+        int shift = bit_width(v) - subBucketBits;
+        return static_cast<size_t>(subBucketCount + (shift - 1) * halfCount + ((v >> shift) - halfCount));
+    }
+
+    // Largest value that lands in bucket i
+    static uint64_t upperBoundOf(size_t i) {
+        if (i < subBucketCount) return i;
+        uint64_t shift = (i - subBucketCount) / halfCount + 1;
+        uint64_t mantissa = (i - subBucketCount) % halfCount + halfCount;
+        return ((mantissa + 1) << shift) - 1;
+    }
+
+    static void add(atomic<uint64_t>& a, uint64_t v) {
+        a.store(a.load(memory_order_relaxed) + v, memory_order_relaxed); // single writer
+    }
+
+    static pair<size_t, size_t> chunkOf(size_t i) {
+        if (i < subBucketCount) return { 0, i };
+        return { (i - subBucketCount) / halfCount + 1, (i - subBucketCount) % halfCount };
+    }
+
+    // Counter for bucket i, allocating its chunk if needed (writer only)
+    atomic<uint64_t>& bucket(size_t i) {
+        auto [c, offset] = chunkOf(i);
+        atomic<uint64_t>* chunk = chunks[c].load(memory_order_relaxed);
+        if (!chunk) {
+            chunk = new atomic<uint64_t>[c == 0 ? subBucketCount : halfCount]();
+            chunks[c].store(chunk, memory_order_release);
+        }
+        return chunk[offset];
+    }
+
+    uint64_t countAt(size_t i) const {
+        auto [c, offset] = chunkOf(i);
+        atomic<uint64_t>* chunk = chunks[c].load(memory_order_acquire);
+        return chunk ? chunk[offset].load(memory_order_relaxed) : 0;
+    }
+
+public:
+    LatencyHistogram() = default;
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+    ~LatencyHistogram() {
+        for (auto& c : chunks) delete[] c.load(memory_order_relaxed);
+    }
+
+    void record(SimDuration d) {
+        auto us = chrono::duration_cast<chrono::microseconds>(d).count();
+        uint64_t v = us > 0 ? static_cast<uint64_t>(us) : 0;
+        add(bucket(indexOf(v)), 1);
+        add(total, 1);
+        add(sumMicros, v);
+        if (v > maxMicros.load(memory_order_relaxed)) maxMicros.store(v, memory_order_relaxed);
+    }
+
+    // Not safe against concurrent merges into the same target
+    void mergeFrom(const LatencyHistogram& o) {
+        for (size_t c = 0, base = 0; c < chunkCount; base += c == 0 ? subBucketCount : halfCount, c++) {
+            atomic<uint64_t>* src = o.chunks[c].load(memory_order_acquire);
+            if (!src) continue;
+            for (size_t j = 0; j < (c == 0 ? subBucketCount : halfCount); j++) {
+                if (uint64_t n = src[j].load(memory_order_relaxed)) add(bucket(base + j), n);
+            }
+        }
+        add(total, o.total.load(memory_order_relaxed));
+        add(sumMicros, o.sumMicros.load(memory_order_relaxed));
+        maxMicros.store(max(maxMicros.load(memory_order_relaxed), o.maxMicros.load(memory_order_relaxed)),
+                        memory_order_relaxed);
+    }
+
+    void save(SnapshotWriter& w) const {
+        w.put(count());
+        w.put(sumMicros.load(memory_order_relaxed));
+        w.put(maxMicros.load(memory_order_relaxed));
+        uint32_t used = 0;
+        for (size_t i = 0; i < bucketCount; i++) used += countAt(i) != 0;
+        w.put(used);
+        for (size_t i = 0; i < bucketCount; i++) {
+            if (uint64_t n = countAt(i)) {
+                w.put(static_cast<uint32_t>(i));
+                w.put(n);
+            }
+        }
+    }
+
+    // Into a histogram with no samples yet
+    void restore(SnapshotReader& r) {
+        total.store(r.get<uint64_t>(), memory_order_relaxed);
+        sumMicros.store(r.get<uint64_t>(), memory_order_relaxed);
+        maxMicros.store(r.get<uint64_t>(), memory_order_relaxed);
+        for (uint32_t used = r.get<uint32_t>(); used > 0; used--) {
+            uint32_t i = r.get<uint32_t>();
+            if (i >= bucketCount) throw runtime_error("snapshot has a bad histogram bucket");
+            add(bucket(i), r.get<uint64_t>());
+        }
+    }
+
+    uint64_t count() const { return total.load(memory_order_relaxed); }
+    double meanMs() const { return count() ? sumMicros.load(memory_order_relaxed) / 1000.0 / count() : 0; }
+    double maxMs() const { return maxMicros.load(memory_order_relaxed) / 1000.0; }
+
+    // Value at or below which a fraction p of the samples fall
+    double percentileMs(double p) const {
+        uint64_t n = count();
+        if (n == 0) return 0;
+        uint64_t rank = max<uint64_t>(1, static_cast<uint64_t>(ceil(p * n)));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < bucketCount; i++) {
+            seen += countAt(i);
+            if (seen >= rank) return min(upperBoundOf(i), maxMicros.load(memory_order_relaxed)) / 1000.0;
+        }
+        return maxMs();
+    }
+};
+
+// Per-car counters, written only by the car's own thread
+struct ElevatorStats {
+    LatencyHistogram wait; // request timestamp to pickup
+    LatencyHistogram ride; // pickup to drop-off
+    atomic<int64_t> busyNanos{ 0 };
+    atomic<int64_t> lastDropOffNanos{ 0 }; // since the clock's epoch
+    atomic<int64_t> lastIdleNanos{ 0 };    // end of the last busy stretch, since the clock's epoch
+    atomic<uint64_t> fullStops{ 0 }; // stops where a full car had to leave calls waiting
+    atomic<int> peakLoad{ 0 };
+    atomic<uint64_t> stops{ 0 }; // floors where someone got in or out
+    atomic<uint64_t> energyMillijoules{ 0 }; // MotionModel::runEnergy over finished runs
+};
+
+// Physical limits shared by every car in a building. The defaults (no
+// capacity limit, instant doors, fixed time per floor) match the original
+// travel-only model.
+struct CarSpec {
+    int capacity = 0; // passengers on board at once, 0 for unlimited
+    SimDuration boardTime = SimDuration::zero();  // dwell per passenger getting in
+    SimDuration alightTime = SimDuration::zero(); // dwell per passenger getting out
+    SimDuration doorOpenTime = SimDuration::zero();  // once per stop
+    SimDuration doorCloseTime = SimDuration::zero();
+    // Kinematic travel (see MotionModel); maxSpeed 0 keeps floorTravelTime per floor
+    double floorHeight = 3.5;  // m
+    double maxSpeed = 0;       // m/s
+    double acceleration = 1.0; // m/s^2
+    double jerk = 0;           // m/s^3, 0 for instant changes in acceleration
+};
+
+// Traction drive energy: the counterweight balances the empty car plus 40%
+// of a nominal load. Accelerating the moving masses and lifting the heavier
+// side draw through the drive losses; braking and overhauling return nothing.
+const double carMassKg = 1000;
+const double passengerMassKg = 75;
+const double counterweightKg = carMassKg + 0.4 * 8 * passengerMassKg;
+const double driveEfficiency = 0.8;
+
+// Travel times between floors. A run is the stretch between two stops:
+// the car accelerates at full effort (jerk, then acceleration, then speed
+// limited) and brakes on the mirror image of that curve, so a run too short
+// to reach top speed turns around at its midpoint. The time to cover each
+// half floor from rest is tabulated once per building, which makes every
+// segment of every run a few lookups. With maxSpeed 0 each floor takes
+// floorTravelTime, as before.
+class MotionModel {
+private:
+    bool kinematic = false;
+    double floorHeight = 0;
+    vector<SimDuration> reach; // by half floors covered from rest
+    vector<double> speedAt;    // m/s at that point
+    SimDuration perFloor = floorTravelTime;
+    SimDuration perStop = stopPenalty;
+
+    // From the start of a rest-to-rest run of `run` floors to passing floor k of it
+    SimDuration passTime(int run, int k) const {
+        return 2 * k <= run ? reach[2 * k] : 2 * reach[run] - reach[2 * (run - k)];
+    }
+
+public:
+    MotionModel() = default;
+    MotionModel(const CarSpec& spec, int floors);
+
+    bool isKinematic() const { return kinematic; }
+
+    // Floor `passed` to the next one in a run of `run` floors (passed < run)
+    SimDuration floorTime(int run, int passed) const {
+        if (!kinematic) return floorTravelTime;
+        return passTime(run, passed + 1) - passTime(run, passed);
+    }
+
+    // Rest to rest over `floors`
+    SimDuration tripTime(int floors) const { return kinematic ? 2 * reach[floors] : floors * floorTravelTime; }
+
+    // Linear pickup-cost weights, rounded to whole milliseconds so the fleet
+    // kernels can score in exact integers: cruise time per floor, and the
+    // braking, restart and door time a stop adds
+    SimDuration travelEstimate() const { return perFloor; }
+    SimDuration stopEstimate() const { return perStop; }
+
+    // Joules drawn by one run of `floors` in `dir` carrying `passengers`;
+    // zero under the fixed-time model, which has no speeds to go on
+    double runEnergy(int floors, int dir, int passengers) const {
+        if (!kinematic || floors == 0) return 0;
+        double load = passengers * passengerMassKg;
+        double v = speedAt[floors];
+        double kinetic = 0.5 * (carMassKg + counterweightKg + load) * v * v;
+        double lift = dir * (carMassKg + load - counterweightKg) * 9.81 * floors * floorHeight;
+        return (kinetic + max(0.0, lift)) / driveEfficiency;
+    }
+};
+
+MotionModel::MotionModel(const CarSpec& spec, int floors) {
+    auto wholeMs = [](SimDuration d) {
+        return chrono::duration_cast<SimDuration>(max(chrono::milliseconds(1), chrono::round<chrono::milliseconds>(d)));
+    };
+    SimDuration doors = spec.doorOpenTime + spec.doorCloseTime;
+    perStop = stopPenalty + doors;
+    if (spec.maxSpeed <= 0) return;
+
+    kinematic = true;
+    floorHeight = spec.floorHeight;
+    reach.resize(max(floors, 1));
+    speedAt.resize(reach.size());
+
+    // Step the full-effort curve from rest, noting when each half-floor mark
+    // is crossed, until the car cruises and the rest is distance over speed
+    const double dt = 1e-4, vmax = spec.maxSpeed, amax = spec.acceleration, jerk = spec.jerk;
+    const double mark = floorHeight / 2;
+    double t = 0, x = 0, v = 0, a = jerk > 0 ? 0 : amax;
+    size_t next = 1;
+    while (next < reach.size() && v < vmax) {
+        bool easing = jerk > 0 && v + a * a / (2 * jerk) >= vmax;
+        if (jerk > 0) a = easing ? max(0.0, a - jerk * dt) : min(amax, a + jerk * dt);
+        double nv = easing && a == 0 ? vmax : min(vmax, v + a * dt);
+        double nx = x + (v + nv) / 2 * dt;
+        for (; next < reach.size() && nx >= next * mark; next++) {
+            double f = (next * mark - x) / (nx - x);
+            reach[next] = chrono::duration_cast<SimDuration>(chrono::duration<double>(t + f * dt));
+            speedAt[next] = v + f * (nv - v);
+        }
+        t += dt;
+        x = nx;
+        v = nv;
+    }
+    for (; next < reach.size(); next++) {
+        reach[next] = chrono::duration_cast<SimDuration>(chrono::duration<double>(t + (next * mark - x) / vmax));
+        speedAt[next] = vmax;
+    }
+
+    // Long runs cost floors at cruise speed plus a fixed overhead for
+    // getting up to speed and back down, which is what each stop adds
+    perFloor = wholeMs(chrono::duration_cast<SimDuration>(chrono::duration<double>(floorHeight / vmax)));
+    int longest = static_cast<int>(reach.size()) - 1;
+    perStop = wholeMs(max(SimDuration::zero(), tripTime(longest) - longest * perFloor) + doors);
+}
+
+// Parses SPEED:ACCEL[:JERK] for --motion
+bool parseMotion(const string& s, CarSpec& car) {
+    vector<double> v;
+    stringstream ss(s);
+    string item;
+    while (getline(ss, item, ':')) {
+        char* end = nullptr;
+        v.push_back(strtod(item.c_str(), &end));
+        if (item.empty() || *end != '\0' || v.back() < 0) return false;
+    }
+    if (v.size() < 2 || v.size() > 3 || v[0] <= 0 || v[1] <= 0) return false;
+    car.maxSpeed = v[0];
+    car.acceleration = v[1];
+    car.jerk = v.size() == 3 ? v[2] : 0;
+    return true;
+}
+
+struct LatencySummary {
+    double meanMs = 0, p50Ms = 0, p90Ms = 0, p95Ms = 0, p99Ms = 0, maxMs = 0;
+};
+
+LatencySummary summarize(const LatencyHistogram& h) {
+    return LatencySummary{ h.meanMs(), h.percentileMs(0.5), h.percentileMs(0.9), h.percentileMs(0.95),
+                           h.percentileMs(0.99), h.maxMs() };
+}
+
+// How a wall-clock run wound down (Building::shutdown)
+struct ShutdownReport {
+    double drainSeconds = 0; // intake closed to the last car stopping
+    uint64_t unserved = 0;   // calls still queued when the cars stopped
+    bool timedOut = false;   // the drain deadline passed first
+};
+
+// End-of-run figures, merged over all cars
+struct RunReport {
+    uint64_t served = 0;
+    double simSeconds = 0; // start of the run to the last drop-off
+    LatencySummary wait, ride;
+    vector<double> utilization; // busy fraction per car
+    int capacity = 0;
+    uint64_t fullStops = 0;
+    int peakLoad = 0;
+    uint64_t stops = 0;
+    double energyKwh = 0;       // kinematic motion model only
+    uint64_t allocations = 0;   // heap allocations, whole process, while the run was live
+    optional<ShutdownReport> shutdown; // wall-clock runs only
+};
+
+// What other threads may know about a car's route, published after every step
+struct RouteSummary {
+    int floor = 1;
+    int direction = 0;
+    int stops = 0;     // pending pickups plus drop-offs
+    int turnFloor = 1; // farthest stop in the current direction
+};
+
+// Structure-of-arrays copy of every car's published route, one column per
+// field, so the event loop scores the whole fleet in one pass over contiguous
+// ints instead of locking and visiting each Elevator. Only kept up to date in
+// event-driven runs, where a single thread both steps and dispatches.
+struct FleetTable {
+    vector<int32_t> floor;
+    vector<int32_t> direction;
+    vector<int32_t> target; // RouteSummary::turnFloor
+    vector<int32_t> load;   // stops to make plus calls assigned since the last step
+    int32_t travelCost, stopCost; // Elevator::estimatePickup weights in exact integer units
+
+    explicit FleetTable(int cars);
+    void setCosts(SimDuration travel, SimDuration stop);
+
+    int size() const { return static_cast<int>(floor.size()); }
+
+    void publish(int car, const RouteSummary& s, int queued) {
+        floor[car] = s.floor;
+        direction[car] = s.direction;
+        target[car] = s.turnFloor;
+        load[car] = s.stops + queued;
+    }
+
+    // Car with the lowest Elevator::estimatePickup for r, first on ties
+    int bestFor(const Request& r) const;
+};
+
+// Pickup cost weights in units of gcd(travel, stop penalty), so fleet costs
+// are small exact integers
+const int64_t costUnit = gcd(floorTravelTime.count(), stopPenalty.count());
+const int32_t travelCostUnits = static_cast<int32_t>(floorTravelTime.count() / costUnit);
+const int32_t stopCostUnits = static_cast<int32_t>(stopPenalty.count() / costUnit);
+
+// Fleet scoring kernels: each returns the car with the lowest pickup cost for
+// a call at src heading dir (first on ties), using the same formula as
+// Elevator::estimatePickup in int32 arithmetic. A vector kernel is picked once
+// at startup when the CPU has one; the scalar loop handles everything else.
+using FleetScorer = int (*)(const FleetTable& f, int32_t src, int32_t dir, int32_t travelCost, int32_t stopCost);
+
+int scoreFleetScalar(const FleetTable& f, int32_t src, int32_t dir, int32_t travelCost, int32_t stopCost,
+                     int from = 0, int best = 0, int32_t bestCost = INT32_MAX) {
+    for (int i = from; i < f.size(); i++) {
+        int32_t fl = f.floor[i], d = f.direction[i];
+        int32_t floors = abs(src - fl);
+        if (d != 0 && !(d == dir && (src - fl) * d > 0)) {
+            floors = abs(f.target[i] - fl) + abs(f.target[i] - src);
+        }
+        int32_t cost = floors * travelCost + f.load[i] * stopCost;
+        if (cost < bestCost) {
+            bestCost = cost;
+            best = i;
+        }
+    }
+    return best;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+int scoreFleetAvx2(const FleetTable& f, int32_t src, int32_t dir, int32_t travelCost, int32_t stopCost) {
+    const int n = f.size();
+    const __m256i vsrc = _mm256_set1_epi32(src), vdir = _mm256_set1_epi32(dir);
+    const __m256i vtravel = _mm256_set1_epi32(travelCost), vstop = _mm256_set1_epi32(stopCost);
+    const __m256i zero = _mm256_setzero_si256(), eight = _mm256_set1_epi32(8);
+    __m256i idx = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i bestCost = _mm256_set1_epi32(INT32_MAX), bestIdx = zero;
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i fl = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&f.floor[i]));
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&f.direction[i]));
+        __m256i t = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&f.target[i]));
+        __m256i l = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&f.load[i]));
+
+        __m256i delta = _mm256_sub_epi32(vsrc, fl);
+        __m256i direct = _mm256_abs_epi32(delta);
+        __m256i via = _mm256_add_epi32(_mm256_abs_epi32(_mm256_sub_epi32(t, fl)), _mm256_abs_epi32(_mm256_sub_epi32(t, vsrc)));
+        __m256i ahead = _mm256_and_si256(_mm256_cmpeq_epi32(d, vdir), _mm256_cmpgt_epi32(_mm256_mullo_epi32(delta, d), zero));
+        __m256i useDirect = _mm256_or_si256(_mm256_cmpeq_epi32(d, zero), ahead);
+        __m256i floors = _mm256_blendv_epi8(via, direct, useDirect);
+        __m256i cost = _mm256_add_epi32(_mm256_mullo_epi32(floors, vtravel), _mm256_mullo_epi32(l, vstop));
+
+        __m256i better = _mm256_cmpgt_epi32(bestCost, cost);
+        bestCost = _mm256_min_epi32(bestCost, cost);
+        bestIdx = _mm256_blendv_epi8(bestIdx, idx, better);
+        idx = _mm256_add_epi32(idx, eight);
+    }
+
+    alignas(32) int32_t costs[8], ids[8];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(costs), bestCost);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(ids), bestIdx);
+    int best = 0;
+    int32_t least = INT32_MAX;
+    for (int k = 0; k < 8; k++) {
+        if (costs[k] < least || (costs[k] == least && ids[k] < best)) {
+            least = costs[k];
+            best = ids[k];
+        }
+    }
+    return scoreFleetScalar(f, src, dir, travelCost, stopCost, i, best, least);
+}
+#elif defined(__aarch64__)
+int scoreFleetNeon(const FleetTable& f, int32_t src, int32_t dir, int32_t travelCost, int32_t stopCost) {
+    const int n = f.size();
+    const int32x4_t vsrc = vdupq_n_s32(src), vdir = vdupq_n_s32(dir);
+    const int32x4_t vtravel = vdupq_n_s32(travelCost), vstop = vdupq_n_s32(stopCost);
+    const int32x4_t zero = vdupq_n_s32(0), four = vdupq_n_s32(4);
+    const int32_t lanes[4] = { 0, 1, 2, 3 };
+    int32x4_t idx = vld1q_s32(lanes);
+    int32x4_t bestCost = vdupq_n_s32(INT32_MAX), bestIdx = zero;
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        int32x4_t fl = vld1q_s32(&f.floor[i]);
+        int32x4_t d = vld1q_s32(&f.direction[i]);
+        int32x4_t t = vld1q_s32(&f.target[i]);
+        int32x4_t l = vld1q_s32(&f.load[i]);
+
+        int32x4_t delta = vsubq_s32(vsrc, fl);
+        int32x4_t direct = vabsq_s32(delta);
+        int32x4_t via = vaddq_s32(vabsq_s32(vsubq_s32(t, fl)), vabsq_s32(vsubq_s32(t, vsrc)));
+        uint32x4_t ahead = vandq_u32(vceqq_s32(d, vdir), vcgtq_s32(vmulq_s32(delta, d), zero));
+        uint32x4_t useDirect = vorrq_u32(vceqq_s32(d, zero), ahead);
+        int32x4_t floors = vbslq_s32(useDirect, direct, via);
+        int32x4_t cost = vmlaq_s32(vmulq_s32(floors, vtravel), l, vstop);
+
+        uint32x4_t better = vcgtq_s32(bestCost, cost);
+        bestCost = vminq_s32(bestCost, cost);
+        bestIdx = vbslq_s32(better, idx, bestIdx);
+        idx = vaddq_s32(idx, four);
+    }
+
+    int32_t costs[4], ids[4];
+    vst1q_s32(costs, bestCost);
+    vst1q_s32(ids, bestIdx);
+    int best = 0;
+    int32_t least = INT32_MAX;
+    for (int k = 0; k < 4; k++) {
+        if (costs[k] < least || (costs[k] == least && ids[k] < best)) {
+            least = costs[k];
+            best = ids[k];
+        }
+    }
+    return scoreFleetScalar(f, src, dir, travelCost, stopCost, i, best, least);
+}
+#endif
+
+int scoreFleetPortable(const FleetTable& f, int32_t src, int32_t dir, int32_t travelCost, int32_t stopCost) {
+    return scoreFleetScalar(f, src, dir, travelCost, stopCost);
+}
+
+struct FleetKernel {
+    const char* name;
+    FleetScorer score;
+};
+
+FleetKernel scalarFleetKernel() { return { "scalar", scoreFleetPortable }; }
+
+// Fastest kernel this CPU supports; ELEVATOR_SCALAR_SCORING=1 forces the fallback
+const FleetKernel& fleetKernel() {
+    static const FleetKernel kernel = [] {
+        const char* force = getenv("ELEVATOR_SCALAR_SCORING");
+        if (force && *force && *force != '0') return scalarFleetKernel();
+#if defined(__x86_64__) || defined(__i386__)
+        if (__builtin_cpu_supports("avx2")) return FleetKernel{ "avx2", scoreFleetAvx2 };
+#elif defined(__aarch64__)
+        return FleetKernel{ "neon", scoreFleetNeon };
+#endif
+        return scalarFleetKernel();
+    }();
+    return kernel;
+}
+
+FleetTable::FleetTable(int cars)
+    : floor(cars, 1), direction(cars, 0), target(cars, 1), load(cars, 0), travelCost(travelCostUnits),
+      stopCost(stopCostUnits) {}
+
+// Same reduction as travelCostUnits: scaling both weights by their gcd keeps
+// every comparison the same and the products small
+void FleetTable::setCosts(SimDuration travel, SimDuration stop) {
+    int64_t unit = gcd(travel.count(), stop.count());
+    travelCost = static_cast<int32_t>(travel.count() / unit);
+    stopCost = static_cast<int32_t>(stop.count() / unit);
+}
+
+// Car with the lowest Elevator::estimatePickup for r, first on ties
+int FleetTable::bestFor(const Request& r) const {
+    return fleetKernel().score(*this, r.sourceFloor, r.direction(), travelCost, stopCost);
+}
+
+// Bounded multi-producer/multi-consumer ring (Dmitry Vyukov's design).
+// Each cell's sequence number says whether it is ready for the producer or
+// the consumer at a given position, so both sides only CAS their own index.
+template <typename T>
+class MpmcRing {
+private:
+    struct Cell {
+        atomic<size_t> seq;
+        T value;
+    };
+
+    unique_ptr<Cell[]> cells;
+    size_t mask;
+    alignas(64) atomic<size_t> enqueuePos{ 0 };
+    alignas(64) atomic<size_t> dequeuePos{ 0 };
+
+public:
+    explicit MpmcRing(size_t capacity) : cells(new Cell[capacity]), mask(capacity - 1) {
+        if (capacity < 2 || (capacity & mask) != 0) {
+            throw invalid_argument("MpmcRing capacity must be a power of two");
+        }
+        for (size_t i = 0; i < capacity; i++) {
+            cells[i].seq.store(i, memory_order_relaxed);
+        }
+    }
+
+    bool tryPush(const T& v) {
+        size_t pos = enqueuePos.load(memory_order_relaxed);
+        for (;;) {
+            Cell& c = cells[pos & mask];
+            size_t seq = c.seq.load(memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    c.value = v;
+                    c.seq.store(pos + 1, memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0) {
+                return false; // full
+            }
+            else {
+                pos = enqueuePos.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    bool empty() const {
+        return dequeuePos.load(memory_order_relaxed) >= enqueuePos.load(memory_order_relaxed);
+    }
+
+    // Exact only when no push or pop is in flight
+    size_t sizeApprox() const {
+        size_t head = dequeuePos.load(memory_order_relaxed), tail = enqueuePos.load(memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+    bool tryPop(T& out) {
+        size_t pos = dequeuePos.load(memory_order_relaxed);
+        for (;;) {
+            Cell& c = cells[pos & mask];
+            size_t seq = c.seq.load(memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (dequeuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    out = c.value;
+                    c.seq.store(pos + mask + 1, memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0) {
+                return false; // empty
+            }
+            else {
+                pos = dequeuePos.load(memory_order_relaxed);
+            }
+        }
+    }
+};
+
+// Bounded single-producer/single-consumer ring: one thread pushes, one pops
+template <typename T>
+class SpscRing {
+private:
+    unique_ptr<T[]> items;
+    size_t mask;
+    alignas(64) atomic<size_t> head{ 0 }; // next slot to pop
+    alignas(64) atomic<size_t> tail{ 0 }; // next slot to push
+
+public:
+    explicit SpscRing(size_t capacity) : items(new T[capacity]), mask(capacity - 1) {
+        if (capacity < 2 || (capacity & mask) != 0) {
+            throw invalid_argument("SpscRing capacity must be a power of two");
+        }
+    }
+
+    bool tryPush(const T& v) {
+        size_t t = tail.load(memory_order_relaxed);
+        if (t - head.load(memory_order_acquire) > mask) return false;
+        items[t & mask] = v;
+        tail.store(t + 1, memory_order_release);
+        return true;
+    }
+
+    bool tryPop(T& out) {
+        size_t h = head.load(memory_order_relaxed);
+        if (h == tail.load(memory_order_acquire)) return false;
+        out = items[h & mask];
+        head.store(h + 1, memory_order_release);
+        return true;
+    }
+};
+
+// Contention and scheduling counters, one set per thread, collected once
+// profiling is switched on (MetricsExporter::start). Only the owning thread
+// writes its counters, with plain relaxed loads and stores instead of
+// read-modify-writes, so counting costs a few ordinary instructions; the
+// clock is only read once a thread is about to block.
+enum class LockSite { Building, Inbox };
+enum class WaitSite { Building, Inbox, Ring, Scheduler };
+constexpr const char* lockSiteNames[] = { "building", "inbox" };
+constexpr const char* waitSiteNames[] = { "building", "inbox", "ring", "scheduler" };
+
+struct ThreadStats {
+    struct Lock {
+        atomic<uint64_t> acquired{ 0 }, contended{ 0 }, waitNanos{ 0 };
+    };
+    // waits: times the thread blocked; wakeups: times it came back, spurious
+    // ones finding nothing to do and going back to sleep
+    struct Wait {
+        atomic<uint64_t> waits{ 0 }, wakeups{ 0 }, spurious{ 0 }, waitNanos{ 0 };
+    };
+
+    string name; // under ThreadRegistry's lock
+    chrono::steady_clock::time_point born = chrono::steady_clock::now();
+    array<Lock, 2> locks;
+    array<Wait, 4> waits;
+    atomic<uint64_t> logStalls{ 0 }, logStallNanos{ 0 }; // log ring full, see AsyncLogger::log
+
+    static void bump(atomic<uint64_t>& c, uint64_t by = 1) {
+        c.store(c.load(memory_order_relaxed) + by, memory_order_relaxed);
+    }
+    static uint64_t nanosSince(chrono::steady_clock::time_point t) {
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - t).count();
+    }
+    Lock& lock(LockSite s) { return locks[static_cast<size_t>(s)]; }
+    Wait& wait(WaitSite s) { return waits[static_cast<size_t>(s)]; }
+};
+
+// Every thread's stats, kept after the thread exits so totals stay complete
+class ThreadRegistry {
+private:
+    mutex mtx;
+    vector<shared_ptr<ThreadStats>> threads;
+
+public:
+    static ThreadRegistry& instance() {
+        static ThreadRegistry registry;
+        return registry;
+    }
+
+    ThreadStats& local() {
+        thread_local ThreadStats* stats = nullptr;
+        if (!stats) {
+            auto s = make_shared<ThreadStats>();
+            lock_guard<mutex> lk(mtx);
+            s->name = "thread " + to_string(threads.size());
+            threads.push_back(s);
+            stats = s.get();
+        }
+        return *stats;
+    }
+
+    // Labels the calling thread in the exported metrics
+    void nameThread(string name) {
+        ThreadStats& s = local();
+        lock_guard<mutex> lk(mtx);
+        s.name = move(name);
+    }
+
+    template <typename Fn>
+    void forEach(Fn fn) {
+        lock_guard<mutex> lk(mtx);
+        for (auto& t : threads) fn(*t);
+    }
+};
+
+inline ThreadStats& threadStats() { return ThreadRegistry::instance().local(); }
+
+// Off by default so runs that export nothing pay one relaxed load per lock or wait
+inline atomic<bool> profiling{ false };
+
+// A std::mutex that counts its acquisitions per thread and times the ones
+// that had to wait. Locking through the base class (unique_lock<mutex> or a
+// condition variable reacquiring it) goes uncounted; use acquire() for a
+// unique_lock that is.
+class ProfiledMutex : public mutex {
+private:
+    LockSite site;
+
+public:
+    explicit ProfiledMutex(LockSite site) : site(site) {}
+
+    void lock() {
+        if (!profiling.load(memory_order_relaxed)) return mutex::lock();
+        ThreadStats::Lock& s = threadStats().lock(site);
+        if (!try_lock()) {
+            auto began = chrono::steady_clock::now();
+            mutex::lock();
+            ThreadStats::bump(s.contended);
+            ThreadStats::bump(s.waitNanos, ThreadStats::nanosSince(began));
+        }
+        ThreadStats::bump(s.acquired);
+    }
+
+    unique_lock<mutex> acquire() {
+        lock();
+        return unique_lock<mutex>(*this, adopt_lock);
+    }
+};
+
+// cv.wait(lk, ready) that counts the wait, each wakeup and the spurious ones
+template <typename Pred>
+void countedWait(WaitSite site, condition_variable& cv, unique_lock<mutex>& lk, Pred ready) {
+    if (!profiling.load(memory_order_relaxed)) return cv.wait(lk, ready);
+    if (ready()) return;
+    ThreadStats::Wait& s = threadStats().wait(site);
+    ThreadStats::bump(s.waits);
+    auto began = chrono::steady_clock::now();
+    for (;;) {
+        cv.wait(lk);
+        ThreadStats::bump(s.wakeups);
+        if (ready()) break;
+        ThreadStats::bump(s.spurious);
+    }
+    ThreadStats::bump(s.waitNanos, ThreadStats::nanosSince(began));
+}
+
+// Log levels, most verbose first
+enum class LogLevel { Trace, Debug, Info, Off };
+
+// Events below this level are compiled out entirely (e.g. -DELEVATOR_MIN_LOG_LEVEL=1
+// drops the per-floor "Passing floor" lines)
+#ifndef ELEVATOR_MIN_LOG_LEVEL
+#define ELEVATOR_MIN_LOG_LEVEL 0
+#endif
+
+enum class LogEvent : uint8_t { PassingFloor, PickUp, DropOff, RequestTime };
+
+constexpr LogLevel levelOf(LogEvent e) {
+    switch (e) {
+    case LogEvent::PassingFloor: return LogLevel::Trace;
+    case LogEvent::PickUp:
+    case LogEvent::DropOff: return LogLevel::Debug;
+    default: return LogLevel::Info;
+    }
+}
+
+// Binary log record; text is only produced by the writer thread
+struct LogRecord {
+    int32_t car;
+    LogEvent event;
+    int64_t value; // floor, or latency in ms for RequestTime
+};
+
+// Asynchronous logger: each logging thread owns an SPSC ring of LogRecords
+// that a background writer drains, formats and writes in batches with one
+// flush per batch. When the writer is not running, records are written
+// synchronously so tools that never start it still see their output.
+class AsyncLogger {
+private:
+    static constexpr size_t ringCapacity = 1 << 14;
+
+    mutex registryMtx; // guards rings; taken once per logging thread and by the writer
+    vector<shared_ptr<SpscRing<LogRecord>>> rings;
+    mutex syncMtx;
+    atomic<int> level{ static_cast<int>(LogLevel::Trace) };
+    atomic<uint32_t> sampleEvery{ 1 };
+    atomic<bool> running{ false };
+    thread writer;
+
+    SpscRing<LogRecord>& threadRing() {
+        thread_local shared_ptr<SpscRing<LogRecord>> ring;
+        if (!ring) {
+            ring = make_shared<SpscRing<LogRecord>>(ringCapacity);
+            lock_guard<mutex> lk(registryMtx);
+            rings.push_back(ring);
+        }
+        return *ring;
+    }
+
+    static void format(const LogRecord& r, string& out) {
+        char num[24];
+        out += "[E";
+        out.append(num, to_chars(num, num + sizeof(num), r.car).ptr);
+        switch (r.event) {
+        case LogEvent::PassingFloor: out += "] Passing floor "; break;
+        case LogEvent::PickUp: out += "] Pick up at "; break;
+        case LogEvent::DropOff: out += "] Drop off at "; break;
+        case LogEvent::RequestTime: out += "] Request time: "; break;
+        }
+        out.append(num, to_chars(num, num + sizeof(num), r.value).ptr);
+        if (r.event == LogEvent::RequestTime) out += " ms";
+        out += '\n';
+    }
+
+    size_t drainOnce(string& buf) {
+        size_t n = 0;
+        lock_guard<mutex> lk(registryMtx);
+        for (auto& ring : rings) {
+            LogRecord r;
+            while (ring->tryPop(r)) {
+                format(r, buf);
+                n++;
+            }
+        }
+        return n;
+    }
+
+    void writeOut(string& buf) {
+        if (buf.empty()) return;
+        fwrite(buf.data(), 1, buf.size(), stdout);
+        fflush(stdout);
+        buf.clear();
+    }
+
+    void drainLoop() {
+        string buf;
+        while (running) {
+            if (drainOnce(buf) == 0) this_thread::sleep_for(chrono::milliseconds(1));
+            writeOut(buf);
+        }
+        drainOnce(buf);
+        writeOut(buf);
+    }
+
+public:
+    static AsyncLogger& instance() {
+        static AsyncLogger logger;
+        return logger;
+    }
+
+    void setLevel(LogLevel l) { level = static_cast<int>(l); }
+    // Keep one in every n per-floor (Trace) events
+    void setSampleEvery(uint32_t n) { sampleEvery = max<uint32_t>(n, 1); }
+
+    void start() {
+        if (running.exchange(true)) return;
+        writer = thread([this] {
+            ThreadRegistry::instance().nameThread("logger");
+            drainLoop();
+        });
+    }
+
+    // Drains every ring and joins the writer; call once the logging threads
+    // are done and before printing anything else
+    void stop() {
+        if (!running.exchange(false)) return;
+        writer.join();
+    }
+
+    template <LogEvent E>
+    void log(int car, int64_t value) {
+        if constexpr (static_cast<int>(levelOf(E)) < ELEVATOR_MIN_LOG_LEVEL) {
+            return;
+        }
+        else {
+            if (static_cast<int>(levelOf(E)) < level.load(memory_order_relaxed)) return;
+            if constexpr (levelOf(E) == LogLevel::Trace) {
+                thread_local uint32_t traceCount = 0;
+                if (traceCount++ % sampleEvery.load(memory_order_relaxed) != 0) return;
+            }
+            LogRecord r = { car, E, value };
+            if (!running.load(memory_order_acquire)) {
+                string buf;
+                format(r, buf);
+                lock_guard<mutex> lk(syncMtx);
+                writeOut(buf);
+                return;
+            }
+            auto& ring = threadRing();
+            if (!ring.tryPush(r)) {
+                // Writer is behind: back off, and count it when profiling
+                if (!profiling.load(memory_order_relaxed)) {
+                    while (!ring.tryPush(r)) this_thread::yield();
+                    return;
+                }
+                ThreadStats& s = threadStats();
+                auto began = chrono::steady_clock::now();
+                do this_thread::yield();
+                while (!ring.tryPush(r));
+                ThreadStats::bump(s.logStalls);
+                ThreadStats::bump(s.logStallNanos, ThreadStats::nanosSince(began));
+            }
+        }
+    }
+};
+
+// Columnar binary event log (--event-log). Each recording thread appends
+// fixed-width EventRecords to a buffer of its own; a full buffer is handed
+// to a writer thread, which stores it as one chunk of five columns. Every
+// column is a run of LEB128 varints, delta- and zigzag-coded for time and
+// request id, so most fields take one byte and a timestamp two or three.
+// File layout:
+//   EventLogHeader
+//   per chunk: EventChunkHeader, then the time, car, event, floor and request columns
+//   the chunks' file offsets (uint64 each), then an EventLogTrailer
+// Host byte order, like snapshots. EventLogReader maps the file and decodes
+// a chunk at a time.
+enum class CarEvent : uint8_t { Call, PassFloor, PickUp, DropOff };
+constexpr const char* carEventNames[] = { "calls", "floors passed", "pick-ups", "drop-offs" };
+
+struct EventRecord {
+    int64_t timeNanos; // since the clock's epoch
+    uint32_t request;  // Request::id, 0 for PassFloor
+    int16_t car;       // -1 for calls, which are logged before routing
+    int16_t floor;
+    CarEvent event;
+};
+
+struct EventLogHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+};
+
+struct EventChunkHeader {
+    uint32_t records;
+    uint32_t columnBytes[5];
+};
+
+struct EventLogTrailer {
+    uint64_t chunks;
+    uint64_t events;
+    uint64_t indexOffset; // where the chunk offsets start
+    char magic[8];
+};
+
+constexpr char eventLogMagic[8] = { 'E', 'L', 'E', 'V', 'L', 'O', 'G', '1' };
+constexpr uint32_t eventLogVersion = 1;
+
+inline void putVarint(vector<uint8_t>& out, uint64_t v) {
+    for (; v >= 0x80; v >>= 7) out.push_back(static_cast<uint8_t>(v | 0x80));
+    out.push_back(static_cast<uint8_t>(v));
+}
+
+inline uint64_t zigzag(int64_t v) { return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63); }
+inline int64_t unzigzag(uint64_t v) { return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1); }
+
+class EventLog {
+private:
+    static constexpr size_t chunkRecords = 1 << 16;
+    static constexpr size_t maxQueued = 8; // full chunks waiting for the writer before recorders block
+
+    struct Buffer {
+        vector<EventRecord> records; // owner thread only while the log is running
+    };
+
+    mutex mtx; // guards everything below except the file, taken once per chunk
+    condition_variable ready; // the writer waits for chunks
+    condition_variable room;  // recorders wait while maxQueued chunks are queued
+    vector<shared_ptr<Buffer>> buffers;
+    deque<vector<EventRecord>> full;
+    vector<vector<EventRecord>> spare;
+    bool stopping = false;
+    atomic<bool> running{ false };
+    thread writer;
+
+    // Writer thread only, then stop()
+    ofstream out;
+    string path;
+    uint64_t offset = 0;
+    uint64_t events = 0;
+    vector<uint64_t> chunkOffsets;
+    vector<uint8_t> encoded;
+
+    Buffer& threadBuffer() {
+        thread_local shared_ptr<Buffer> buffer;
+        if (!buffer) {
+            buffer = make_shared<Buffer>();
+            buffer->records.reserve(chunkRecords);
+            lock_guard<mutex> lk(mtx);
+            buffers.push_back(buffer);
+        }
+        return *buffer;
+    }
+
+    void handOff(vector<EventRecord>& records) {
+        unique_lock<mutex> lk(mtx);
+        room.wait(lk, [&] { return full.size() < maxQueued; });
+        full.push_back(move(records));
+        if (!spare.empty()) {
+            records = move(spare.back());
+            spare.pop_back();
+        }
+        else {
+            records = vector<EventRecord>();
+            records.reserve(chunkRecords);
+        }
+        ready.notify_one();
+    }
+
+    void writeChunk(const vector<EventRecord>& chunk) {
+        encoded.assign(sizeof(EventChunkHeader), 0);
+        EventChunkHeader h{};
+        h.records = static_cast<uint32_t>(chunk.size());
+        size_t start = encoded.size();
+        int64_t lastTime = 0;
+        for (const EventRecord& r : chunk) {
+            putVarint(encoded, zigzag(r.timeNanos - lastTime));
+            lastTime = r.timeNanos;
+        }
+        h.columnBytes[0] = static_cast<uint32_t>(encoded.size() - start);
+        start = encoded.size();
+        for (const EventRecord& r : chunk) putVarint(encoded, static_cast<uint64_t>(r.car + 1));
+        h.columnBytes[1] = static_cast<uint32_t>(encoded.size() - start);
+        for (const EventRecord& r : chunk) encoded.push_back(static_cast<uint8_t>(r.event));
+        h.columnBytes[2] = static_cast<uint32_t>(chunk.size());
+        start = encoded.size();
+        for (const EventRecord& r : chunk) putVarint(encoded, static_cast<uint64_t>(r.floor));
+        h.columnBytes[3] = static_cast<uint32_t>(encoded.size() - start);
+        start = encoded.size();
+        int64_t lastRequest = 0;
+        for (const EventRecord& r : chunk) {
+            putVarint(encoded, zigzag(static_cast<int64_t>(r.request) - lastRequest));
+            lastRequest = r.request;
+        }
+        h.columnBytes[4] = static_cast<uint32_t>(encoded.size() - start);
+        memcpy(encoded.data(), &h, sizeof h);
+
+        out.write(reinterpret_cast<const char*>(encoded.data()), static_cast<streamsize>(encoded.size()));
+        chunkOffsets.push_back(offset);
+        offset += encoded.size();
+        events += chunk.size();
+    }
+
+    void writeLoop() {
+        unique_lock<mutex> lk(mtx);
+        for (;;) {
+            ready.wait(lk, [&] { return !full.empty() || stopping; });
+            if (full.empty()) return;
+            vector<EventRecord> chunk = move(full.front());
+            full.pop_front();
+            room.notify_all();
+            lk.unlock();
+            writeChunk(chunk);
+            chunk.clear();
+            lk.lock();
+            spare.push_back(move(chunk));
+        }
+    }
+
+    void joinWriter() {
+        {
+            lock_guard<mutex> lk(mtx);
+            for (auto& b : buffers) {
+                if (!b->records.empty()) full.push_back(move(b->records));
+                b->records = vector<EventRecord>();
+            }
+            stopping = true;
+        }
+        ready.notify_one();
+        writer.join();
+    }
+
+public:
+    static EventLog& instance() {
+        static EventLog log;
+        return log;
+    }
+
+    ~EventLog() { halt(); }
+
+    bool active() const { return running.load(memory_order_relaxed); }
+
+    // Truncates path and starts the writer; call before any thread records
+    void start(const string& file) {
+        if (running) return;
+        path = file;
+        out.open(path, ios::binary | ios::trunc);
+        if (!out) throw runtime_error("cannot open event log " + path);
+        EventLogHeader h{};
+        memcpy(h.magic, eventLogMagic, sizeof h.magic);
+        h.version = eventLogVersion;
+        out.write(reinterpret_cast<const char*>(&h), sizeof h);
+        offset = sizeof h;
+        events = 0;
+        chunkOffsets.clear();
+        stopping = false;
+        writer = thread([this] {
+            ThreadRegistry::instance().nameThread("event log");
+            writeLoop();
+        });
+        running.store(true, memory_order_release);
+    }
+
+    void record(CarEvent e, int car, int floor, uint32_t request, SimTime at) {
+        if (!running.load(memory_order_relaxed)) return;
+        Buffer& b = threadBuffer();
+        auto ns = chrono::duration_cast<chrono::nanoseconds>(at.time_since_epoch()).count();
+        b.records.push_back({ ns, request, static_cast<int16_t>(car), static_cast<int16_t>(floor), e });
+        if (b.records.size() == chunkRecords) handOff(b.records);
+    }
+
+    // Writes what every thread still holds, then the chunk index; call once
+    // the recording threads are done. Returns the number of events written.
+    uint64_t stop() {
+        if (!running.exchange(false)) return 0;
+        joinWriter();
+        EventLogTrailer t{};
+        t.chunks = chunkOffsets.size();
+        t.events = events;
+        t.indexOffset = offset;
+        memcpy(t.magic, eventLogMagic, sizeof t.magic);
+        out.write(reinterpret_cast<const char*>(chunkOffsets.data()),
+                  static_cast<streamsize>(chunkOffsets.size() * sizeof(uint64_t)));
+        out.write(reinterpret_cast<const char*>(&t), sizeof t);
+        out.close();
+        if (!out) throw runtime_error("cannot write event log " + path);
+        return t.events;
+    }
+
+    // Stops the writer without finishing the file, for error paths
+    void halt() noexcept {
+        if (!running.exchange(false)) return;
+        joinWriter();
+        out.close();
+    }
+};
+
+// Maps a finished event log read-only and decodes it a chunk at a time
+class EventLogReader {
+public:
+    struct Columns {
+        vector<int64_t> timeNanos;
+        vector<int16_t> car;
+        vector<CarEvent> event;
+        vector<int16_t> floor;
+        vector<uint32_t> request;
+
+        size_t size() const { return timeNanos.size(); }
+    };
+
+private:
+    string path;
+    const uint8_t* base = nullptr;
+    size_t bytes = 0;
+    EventLogTrailer trailer{};
+    const uint8_t* index = nullptr;
+
+    [[noreturn]] void corrupt() const { throw runtime_error(path + " is truncated or corrupt"); }
+
+    // Decodes n varints from [p, end) through f
+    template <typename F>
+    void decode(const uint8_t* p, const uint8_t* end, uint32_t n, F f) const {
+        for (uint32_t i = 0; i < n; i++) {
+            uint64_t v = 0;
+            for (int shift = 0;; shift += 7) {
+                if (p == end || shift > 63) corrupt();
+                uint8_t b = *p++;
+                v |= static_cast<uint64_t>(b & 0x7f) << shift;
+                if (!(b & 0x80)) break;
+            }
+            f(v);
+        }
+        if (p != end) corrupt();
+    }
+
+public:
+    explicit EventLogReader(const string& file) : path(file) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw runtime_error("cannot open event log " + path);
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(EventLogHeader) + sizeof(EventLogTrailer)) {
+            close(fd);
+            throw runtime_error(path + " is not a finished event log");
+        }
+        bytes = static_cast<size_t>(st.st_size);
+        void* m = mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (m == MAP_FAILED) throw runtime_error("cannot map event log " + path);
+        madvise(m, bytes, MADV_SEQUENTIAL);
+        base = static_cast<const uint8_t*>(m);
+
+        EventLogHeader h;
+        memcpy(&h, base, sizeof h);
+        memcpy(&trailer, base + bytes - sizeof trailer, sizeof trailer);
+        bool valid = memcmp(h.magic, eventLogMagic, sizeof h.magic) == 0 && h.version == eventLogVersion &&
+                     memcmp(trailer.magic, eventLogMagic, sizeof trailer.magic) == 0 &&
+                     trailer.indexOffset >= sizeof h && trailer.indexOffset <= bytes - sizeof trailer &&
+                     trailer.chunks == (bytes - sizeof trailer - trailer.indexOffset) / sizeof(uint64_t) &&
+                     (bytes - sizeof trailer - trailer.indexOffset) % sizeof(uint64_t) == 0;
+        if (!valid) {
+            munmap(m, bytes);
+            throw runtime_error(path + " is not a finished event log from this version");
+        }
+        index = base + trailer.indexOffset;
+    }
+
+    EventLogReader(const EventLogReader&) = delete;
+    EventLogReader& operator=(const EventLogReader&) = delete;
+
+    ~EventLogReader() { munmap(const_cast<uint8_t*>(base), bytes); }
+
+    uint64_t chunks() const { return trailer.chunks; }
+    uint64_t events() const { return trailer.events; }
+    size_t fileBytes() const { return bytes; }
+
+    // Replaces out's contents with chunk i. Offsets and lengths come from
+    // the file, so each is checked against the chunk area before use.
+    void read(size_t i, Columns& out) const {
+        if (i >= trailer.chunks) throw out_of_range("event log has no chunk " + to_string(i));
+        uint64_t at;
+        memcpy(&at, index + i * sizeof at, sizeof at);
+        uint64_t end = trailer.indexOffset; // chunks lie between the header and the index
+        if (at < sizeof(EventLogHeader) || at > end || end - at < sizeof(EventChunkHeader)) corrupt();
+        EventChunkHeader h;
+        memcpy(&h, base + at, sizeof h);
+        uint64_t length = sizeof h;
+        for (uint32_t n : h.columnBytes) length += n;
+        if (length > end - at) corrupt();
+        const uint8_t* column[6] = { base + at + sizeof h };
+        for (int c = 0; c < 5; c++) column[c + 1] = column[c] + h.columnBytes[c];
+        if (h.columnBytes[2] != h.records) corrupt();
+
+        out.timeNanos.clear();
+        out.car.clear();
+        out.event.clear();
+        out.floor.clear();
+        out.request.clear();
+        int64_t time = 0;
+        decode(column[0], column[1], h.records, [&](uint64_t v) { out.timeNanos.push_back(time += unzigzag(v)); });
+        decode(column[1], column[2], h.records, [&](uint64_t v) { out.car.push_back(static_cast<int16_t>(v - 1)); });
+        for (const uint8_t* e = column[2]; e != column[3]; e++) {
+            if (*e > static_cast<uint8_t>(CarEvent::DropOff)) corrupt();
+            out.event.push_back(static_cast<CarEvent>(*e));
+        }
+        decode(column[3], column[4], h.records, [&](uint64_t v) { out.floor.push_back(static_cast<int16_t>(v)); });
+        int64_t request = 0;
+        decode(column[4], column[5], h.records,
+               [&](uint64_t v) { out.request.push_back(static_cast<uint32_t>(request += unzigzag(v))); });
+    }
+};
+
+// Elevator class declaration
+class Elevator {
+private:
+    int id;
+    int currentFloor = 1;
+    thread thr;
+    Building* building;
+    atomic<bool> running{ true }; // cleared to abandon the queue after a drain deadline
+
+    // Requests assigned to the car but not yet picked up, and passengers on board
+    SlabPool stopPool; // pending, riders and claimed; owner thread only
+    PoolVector<Request> pending;
+    PoolVector<Rider> riders;
+    PoolVector<Request> claimed; // scratch for SCAN pickups from the building's queues
+
+    // Stop index kept in step with pending and riders, so routing questions
+    // (any stop above? farthest stop ahead?) are O(1) instead of a walk over
+    // both lists. Indexed by floor.
+    PoolVector<int32_t> pickupsAt;
+    PoolVector<int32_t> dropOffsAt;
+    int stopTotal = 0;
+    int highestStop = 0;       // valid while stopTotal > 0
+    int lowestStop = INT_MAX;
+    RouteSummary published;    // last summary handed out by publishRoute
+    int direction = 0; // +1 up, -1 down, 0 idle
+    bool moving = false;
+    bool busy = false;
+    bool leftBehind = false; // a call at this stop didn't fit
+    // The run under way under the kinematic motion model: where the car last
+    // stood still, where it means to stop next, and who is aboard meanwhile
+    bool inRun = false;
+    int runStart = 1;
+    int runStop = 1;
+    int runLoad = 0;
+    int parkFloor = 0; // where the building sent the car to wait, 0 for nowhere
+    SimTime busySince{};
+    ElevatorStats carStats;
+
+    // Requests routed to this car by the building: merged into pending at each
+    // step under ETA dispatch, or the car's local queue under QueueMode::Local
+    mutable ProfiledMutex inboxMtx{ LockSite::Inbox };
+    condition_variable inboxCv;
+    SlabPool inboxPool; // guarded by inboxMtx
+    HallCallQueue inbox;
+    bool inboxClosed = false;
+    bool stealHint = false; // set when a neighbour has work this car could steal
+    atomic<bool> idle{ false };
+    RouteSummary route;
+
+    template <LogEvent E>
+    void log(int64_t value) { AsyncLogger::instance().log<E>(id, value); }
+    void process(const Request& r);
+    void run();
+    CarTask runAsync(CarScheduler& s);
+    SimDuration serveFloor();
+    void boardAt(int dir);
+    size_t room() const;
+    void addStop(PoolVector<int32_t>& at, int floor);
+    void removeStop(PoolVector<int32_t>& at, int floor);
+    void board(const Request& r);
+    int chooseDirection() const;
+    void publishRoute();
+    SimDuration travel();
+    void endRun();
+    int parkingDirection();
+
+public:
+    Elevator(int id, Building* b);
+    ~Elevator(); // ensure proper cleanup
+    void start();
+    void stop(); // abandon and join; Building::shutdown stops a whole bank at once
+    void abandon() { running = false; }
+    void join();
+
+    // Event-driven interface shared by the threaded and virtual-time modes
+    void accept(const Request& r);
+    optional<SimDuration> step();
+
+    // Cost-based assignment (DispatchMode::Eta), safe to call from any thread
+    SimDuration estimatePickup(const Request& r) const;
+    void assign(const Request& r);
+    void assign(span<const Request> batch);
+    void closeInbox();
+
+    // Per-car queue access; the owner pops the front, thieves take the back
+    optional<Request> popInbox(bool fromBack = false);
+    size_t claimFromInbox(int floor, int dir, size_t room, PoolVector<Request>& out);
+    int nextCallInInbox(int floor, int dir, int limit) const;
+    size_t queuedCalls() const;
+    bool waitForWork();
+    void nudge();
+    bool isIdle() const { return idle; }
+    const ElevatorStats& stats() const { return carStats; }
+    void setIdle(bool v) { idle = v; }
+
+    // Checkpointing for virtual-time runs; restore() expects a freshly built car
+    void save(SnapshotWriter& w) const;
+    void restore(SnapshotReader& r);
+};
+
+// How cars run in wall-clock mode: a thread each, or coroutines that suspend
+// while waiting for a call or travelling and are resumed by a few scheduler
+// threads, so a car costs a coroutine frame instead of a thread stack
+enum class ExecutionMode { Threads, Coroutines };
+
+// A car's coroutine; created suspended and owned by the CarScheduler that runs it
+struct CarTask {
+    struct promise_type {
+        CarTask get_return_object() { return { coroutine_handle<promise_type>::from_promise(*this) }; }
+        suspend_always initial_suspend() noexcept { return {}; }
+        suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { terminate(); }
+    };
+
+    coroutine_handle<promise_type> handle;
+};
+
+// Resumes car coroutines on one thread. A car suspends on nextRequest() until
+// the building has a call for it and on travel() for the length of a move; the
+// thread sleeps on a timed wait in between, so it needs a wall clock.
+// Producers wake it through signal() only while some car is waiting.
+class CarScheduler {
+public:
+    struct RequestAwaiter {
+        CarScheduler& scheduler;
+        int car;
+        optional<Request> result;
+
+        bool await_ready();
+        bool await_suspend(coroutine_handle<> h);
+        optional<Request> await_resume() { return result; }
+    };
+
+    struct TravelAwaiter {
+        CarScheduler& scheduler;
+        SimDuration duration;
+
+        bool await_ready() const noexcept { return duration <= SimDuration::zero(); }
+        void await_suspend(coroutine_handle<> h);
+        void await_resume() const noexcept {}
+    };
+
+private:
+    struct Timer {
+        SimTime at;
+        uint64_t seq; // keeps simultaneous wakeups in scheduling order
+        coroutine_handle<> handle;
+
+        bool operator>(const Timer& o) const {
+            return at != o.at ? at > o.at : seq > o.seq;
+        }
+    };
+
+    struct Waiter {
+        RequestAwaiter* awaiter;
+        coroutine_handle<> handle;
+    };
+
+    Building& building;
+
+    // Scheduler thread only
+    priority_queue<Timer, vector<Timer>, greater<Timer>> timers;
+    uint64_t nextSeq = 0;
+    vector<Waiter> waiters; // in the order cars started waiting
+    vector<pair<int, CarTask>> tasks;
+
+    // Shared with producers and stop()
+    mutex mtx;
+    condition_variable cv;
+    condition_variable doneCv;
+    vector<pair<int, CarTask>> incoming;
+    vector<int> hints; // cars that were handed a call of their own
+    bool sharedHint = false; // a call any waiting car may take
+    bool closing = false;
+    vector<bool> spawned, done;
+    atomic<int> waitingCount{ 0 };
+    thread thr;
+
+    void loop();
+    void pollWaiters(const vector<int>& hinted, bool shared);
+    void reap();
+
+public:
+    CarScheduler(Building& b, int cars);
+    ~CarScheduler(); // destroys any coroutine still suspended
+
+    RequestAwaiter nextRequest(int car) { return { *this, car, nullopt }; }
+    TravelAwaiter travel(SimDuration d) { return { *this, d }; }
+
+    // Thread-safe
+    void spawn(int car, CarTask task);
+    void signal(int car); // car that was handed a call, or -1 for any
+    void waitFor(int car);
+    bool hasWaiters() const {
+        atomic_thread_fence(memory_order_seq_cst); // pairs with the increment in await_suspend
+        return waitingCount.load(memory_order_relaxed) > 0;
+    }
+};
+
+// Online hall-call demand by source floor and time-of-period bucket, used to
+// send idle cars ahead of it (Building::parkingFloorFor). A bucket's counts
+// halve for every period that passed since it was last brought up to date,
+// so a pattern that repeats each period builds up and a one-off burst fades.
+// Not thread-safe; the building guards it.
+class DemandModel {
+private:
+    SimDuration bucketWidth;
+    int buckets;
+    int floors;
+    vector<float> counts;          // bucket-major, floors + 1 per bucket
+    vector<int64_t> updatedPeriod; // period each bucket is aged to
+
+    float* row(int b) { return &counts[static_cast<size_t>(b) * (floors + 1)]; }
+    const float* row(int b) const { return &counts[static_cast<size_t>(b) * (floors + 1)]; }
+
+    void age(int b, int64_t period) {
+        if (updatedPeriod[b] >= period) return;
+        float f = exp2f(-static_cast<float>(period - updatedPeriod[b]));
+        for (int i = 0; i <= floors; i++) row(b)[i] *= f;
+        updatedPeriod[b] = period;
+    }
+
+public:
+    DemandModel(int floors, SimDuration bucket, SimDuration period)
+        : bucketWidth(bucket), buckets(static_cast<int>(max<int64_t>(1, (period + bucket - SimDuration(1)) / bucket))),
+          floors(floors), counts(static_cast<size_t>(buckets) * (floors + 1), 0), updatedPeriod(buckets, 0) {}
+
+    // offset: time since the start of the run
+    void record(int floor, SimDuration offset) {
+        int64_t slot = offset / bucketWidth;
+        int b = static_cast<int>(slot % buckets);
+        age(b, slot / buckets);
+        row(b)[floor] += 1;
+    }
+
+    // The floor with the most calls expected over the rest of the current
+    // bucket and the next, skipping covered ones; 0 unless it stands out at
+    // twice the per-floor average. The next bucket is judged by its last
+    // complete period, the current one by everything seen so far.
+    int hottest(SimDuration offset, const vector<char>& covered) const {
+        int64_t slot = offset / bucketWidth, next = slot + 1;
+        int b = static_cast<int>(slot % buckets), nb = static_cast<int>(next % buckets);
+        auto weight = [&](int bucket, int64_t period) {
+            return exp2f(-static_cast<float>(max<int64_t>(0, period - updatedPeriod[bucket])));
+        };
+        float wNow = weight(b, slot / buckets);
+        float wNext = nb == b ? 0 : weight(nb, next / buckets - 1);
+        float total = 0, best = 0;
+        int bestFloor = 0;
+        for (int f = 1; f <= floors; f++) {
+            float v = wNow * row(b)[f] + wNext * row(nb)[f];
+            total += v;
+            if (!covered[f] && v > best) {
+                best = v;
+                bestFloor = f;
+            }
+        }
+        return best > 0 && best * floors >= 2 * total ? bestFloor : 0;
+    }
+
+    void save(SnapshotWriter& w) const {
+        w.putAll(counts);
+        w.putAll(updatedPeriod);
+    }
+
+    void restore(SnapshotReader& r) {
+        size_t n = counts.size();
+        counts.clear();
+        updatedPeriod.clear();
+        r.getAll<float>(counts);
+        r.getAll<int64_t>(updatedPeriod);
+        if (counts.size() != n || updatedPeriod.size() != static_cast<size_t>(buckets)) {
+            throw runtime_error("snapshot has a different demand model");
+        }
+    }
+};
+
+// Building class definition
+class Building {
+private:
+    vector<shared_ptr<Elevator>> elevators;
+    SlabPool queuePool; // guarded by mtx
+    HallCallQueue requestQ;
+    ProfiledMutex mtx{ LockSite::Building };
+    condition_variable cv;
+    bool acceptingRequests = true;
+    atomic<uint32_t> nextRequestId{ 1 };
+    int waitingCars = 0; // cars blocked on cv
+    int numFloors;
+    SimClock& simClock;
+    DispatchMode mode;
+    QueueMode queueMode;
+    bool eventDriven = false; // stepped by the single-threaded EventSimulator
+
+    // QueueMode::LockFree: cars that run out of spin budget register in
+    // sleepers and block on wakeSeq. A producer only notifies when someone is
+    // asleep and no wakeup is already in flight (wakePending), so a burst of
+    // pushes costs one futex call; the woken car passes the baton on if the
+    // ring is still non-empty.
+    unique_ptr<MpmcRing<Request>> ring;
+    atomic<uint32_t> wakeSeq{ 0 };
+    atomic<int> sleepers{ 0 };
+    atomic<bool> wakePending{ false };
+    atomic<bool> ringClosed{ false };
+    // Event loop only: there is no car thread to make room in a full ring, so
+    // calls spill here, and every later call follows until the cars drain it
+    deque<Request> ringOverflow;
+
+    SimTime startTime;
+    CarSpec cars;
+    MotionModel motionModel;
+    uint64_t allocationsAtStart = heapAllocations.load(memory_order_relaxed);
+    FleetTable fleetTable;
+
+    // Idle-car pre-positioning, off until enablePrepositioning. parkedAt holds
+    // the floor each car was sent to wait at, 0 for none; both under demandMtx.
+    mutex demandMtx;
+    optional<DemandModel> demand;
+    vector<int> parkedAt;
+    void recordDemand(const Request& r) {
+        lock_guard<mutex> lk(demandMtx);
+        demand->record(r.sourceFloor, r.timestamp - startTime);
+    }
+
+    // ExecutionMode::Coroutines: car i runs on schedulers[i % size]. Declared
+    // after elevators so they are torn down before the cars they reference.
+    vector<unique_ptr<CarScheduler>> schedulers;
+    atomic<size_t> nextScheduler{ 0 };
+
+    // DispatchMode::Destination: the open group per (source floor, direction,
+    // destination band), i.e. the car collecting it and the seats it holds.
+    // Guarded by mtx; a car closes its groups at a floor once it has stopped there.
+    struct DestinationGroup {
+        int car = -1;
+        int riders = 0;
+    };
+    vector<DestinationGroup> groups;
+    int destinationBands = 1;
+
+    function<void(const Request&, SimTime)> dropOffHook;
+
+    // Wall-clock cars whose run loop has not returned yet; guarded by mtx
+    int carsRunning = 0;
+    condition_variable drainedCv;
+    optional<ShutdownReport> lastShutdown;
+    uint64_t queuedRequests();
+
+    int routeRequest(const Request& r);
+
+    // Hands out arrival numbers and logs each call as it comes in
+    void number(span<Request> calls) {
+        uint32_t first = nextRequestId.fetch_add(static_cast<uint32_t>(calls.size()), memory_order_relaxed);
+        EventLog& log = EventLog::instance();
+        for (Request& r : calls) {
+            r.id = first++;
+            log.record(CarEvent::Call, -1, r.sourceFloor, r.id, r.timestamp);
+        }
+    }
+    int groupOf(const Request& r) const {
+        int band = (r.destFloor - 1) * destinationBands / numFloors;
+        return ((r.sourceFloor - 1) * 2 + (r.direction() > 0)) * destinationBands + band;
+    }
+    int destinationCar(const Request& r, int riders);
+    void notifySchedulers(int car, int calls = 1);
+
+public:
+    Building(int numElev, int floors, SimClock& clock, DispatchMode mode = DispatchMode::Fifo,
+             QueueMode queueMode = QueueMode::Shared)
+        : requestQ(floors, queuePool), numFloors(floors), simClock(clock), mode(mode),
+          queueMode(queueMode), startTime(clock.now()), fleetTable(numElev) {
+        if (queueMode == QueueMode::LockFree) {
+            ring = make_unique<MpmcRing<Request>>(requestRingCapacity);
+        }
+        for (int i = 0; i < numElev; i++) {
+            elevators.push_back(make_shared<Elevator>(i, this));
+        }
+        if (mode == DispatchMode::Destination) {
+            destinationBands = max(1, min(numElev, floors));
+            groups.resize(static_cast<size_t>(floors) * 2 * destinationBands);
+        }
+    }
+
+    SimClock& clock() { return simClock; }
+    int floors() const { return numFloors; }
+    DispatchMode dispatchMode() const { return mode; }
+    QueueMode queueingMode() const { return queueMode; }
+    // ETA and destination dispatch: the building picks a car for every call
+    bool assignsCars() const { return mode == DispatchMode::Eta || mode == DispatchMode::Destination; }
+    bool perCarQueues() const { return assignsCars() || queueMode == QueueMode::Local; }
+    bool workStealing() const { return !assignsCars() && queueMode == QueueMode::Local; }
+    int elevatorCount() const { return static_cast<int>(elevators.size()); }
+    Elevator& elevator(int i) { return *elevators[i]; }
+
+    void setEventDriven() { eventDriven = true; }
+    bool isEventDriven() const { return eventDriven; }
+
+    // Call before startElevators or the first step
+    void setCarSpec(const CarSpec& spec) {
+        cars = spec;
+        motionModel = MotionModel(spec, numFloors);
+        fleetTable.setCosts(motionModel.travelEstimate(), motionModel.stopEstimate());
+    }
+    const CarSpec& carSpec() const { return cars; }
+    const MotionModel& motion() const { return motionModel; }
+
+    // Learns demand per `bucket` of each `period` from the calls coming in and
+    // parks cars that run out of work at the floors expected to call next.
+    // Call before the run starts.
+    void enablePrepositioning(SimDuration bucket, SimDuration period) {
+        demand.emplace(numFloors, bucket, period);
+        parkedAt.assign(elevators.size(), 0);
+    }
+    bool prepositions() const { return demand.has_value(); }
+    int parkingFloorFor(int car, int floor);
+    void leaveParking(int car) {
+        lock_guard<mutex> lk(demandMtx);
+        parkedAt[car] = 0;
+    }
+    bool hasWaitingCall(int car);
+    size_t waitingCalls();
+    SimDuration elapsed() const { return simClock.now() - startTime; }
+    FleetTable& fleet() { return fleetTable; }
+
+    // Checkpointing for virtual-time runs; restore() expects a freshly built
+    // building with the same cars, floors and modes
+    void save(SnapshotWriter& w);
+    void restore(SnapshotReader& r);
+
+    // Called on the car's thread for every passenger set down; set before the run starts
+    void onDropOff(function<void(const Request&, SimTime)> fn) { dropOffHook = move(fn); }
+    void droppedOff(const Request& r, SimTime at) {
+        if (dropOffHook) dropOffHook(r, at);
+    }
+
+    // Runs cars as coroutines on up to `threads` scheduler threads; call before startElevators
+    void useCoroutines(int threads) {
+        threads = max(1, min(threads, elevatorCount()));
+        for (int i = 0; i < threads; i++) {
+            schedulers.push_back(make_unique<CarScheduler>(*this, elevatorCount()));
+        }
+    }
+
+    CarScheduler* schedulerFor(int car) {
+        return schedulers.empty() ? nullptr : schedulers[car % schedulers.size()].get();
+    }
+
+    void startElevators() {
+        {
+            lock_guard<ProfiledMutex> lk(mtx);
+            carsRunning = elevatorCount();
+        }
+        for (auto& e : elevators) {
+            e->start();
+        }
+    }
+
+    ShutdownReport shutdown(chrono::milliseconds deadline = chrono::milliseconds::zero());
+    void waitForElevators() { shutdown(); }
+
+    // Called by each car as its run loop returns
+    void carStopped() {
+        {
+            lock_guard<ProfiledMutex> lk(mtx);
+            carsRunning--;
+        }
+        drainedCv.notify_all();
+    }
+
+    // Queues a request and returns the car it was routed to, or -1 if it
+    // went to the shared queue for whichever car is free first
+    int addRequest(Request r) {
+        number(span(&r, 1));
+        int car = routeRequest(r);
+        if (!schedulers.empty()) notifySchedulers(car);
+        return car;
+    }
+
+    // Numbers the calls in place (Request::id) before routing them
+    void addRequests(span<Request> batch, vector<int>* routedTo = nullptr);
+
+    void closeGroups(int car, int floor);
+
+    bool isAcceptingRequests() {
+        lock_guard<ProfiledMutex> lk(mtx);
+        return acceptingRequests;
+    }
+
+    int bestElevatorFor(const Request& r) const {
+        if (eventDriven) return fleetTable.bestFor(r);
+        int best = 0;
+        SimDuration bestCost = SimDuration::max();
+        for (int i = 0; i < elevatorCount(); i++) {
+            SimDuration cost = elevators[i]->estimatePickup(r);
+            if (cost < bestCost) {
+                bestCost = cost;
+                best = i;
+            }
+        }
+        return best;
+    }
+
+    // Cars split the floors into equal bands; a call goes to its floor's car
+    int homeElevatorFor(const Request& r) const {
+        return (r.sourceFloor - 1) * elevatorCount() / numFloors;
+    }
+
+    // Calls fn on every other car, nearest ids first, until it returns true
+    template <typename Fn>
+    bool forEachNeighbour(int car, Fn fn) const {
+        for (int d = 1; d < elevatorCount(); d++) {
+            if (car - d >= 0 && fn(car - d)) return true;
+            if (car + d < elevatorCount() && fn(car + d)) return true;
+        }
+        return false;
+    }
+
+    void nudgeIdleNeighbour(int car) {
+        forEachNeighbour(car, [&](int i) {
+            if (!elevators[i]->isIdle()) return false;
+            elevators[i]->nudge();
+            return true;
+        });
+    }
+
+    // The car's own queue first, then the back of the nearest non-empty neighbour's
+    optional<Request> takeLocal(int car) {
+        if (auto r = elevators[car]->popInbox()) return r;
+        optional<Request> stolen;
+        forEachNeighbour(car, [&](int i) {
+            stolen = elevators[i]->popInbox(true);
+            return stolen.has_value();
+        });
+        return stolen;
+    }
+
+    void stopAcceptingRequests() {
+        {
+            lock_guard<ProfiledMutex> lk(mtx);
+            acceptingRequests = false;
+        }
+        cv.notify_all();
+        ringClosed = true;
+        wakeSeq.fetch_add(1, memory_order_release);
+        wakeSeq.notify_all();
+        for (auto& e : elevators) {
+            e->closeInbox();
+        }
+        for (auto& s : schedulers) {
+            s->signal(-1);
+        }
+    }
+
+    // Blocks the calling car until it has a request to serve; nullopt on shutdown
+    optional<Request> waitForRequest(int car) {
+        Elevator& e = *elevators[car];
+        if (assignsCars()) {
+            e.waitForWork();
+            return e.popInbox();
+        }
+        if (queueMode == QueueMode::Local) {
+            e.setIdle(true);
+            optional<Request> r;
+            while (!(r = takeLocal(car)) && e.waitForWork()) {}
+            if (!r) r = takeLocal(car); // last sweep after shutdown was signalled
+            e.setIdle(false);
+            return r;
+        }
+        if (queueMode == QueueMode::LockFree) {
+            return waitOnRing();
+        }
+
+        unique_lock<mutex> lk = mtx.acquire();
+        waitingCars++;
+        countedWait(WaitSite::Building, cv, lk, [&] { return !requestQ.empty() || !acceptingRequests; });
+        waitingCars--;
+
+        return requestQ.popOldest();
+    }
+
+    // Non-blocking variant for the event loop
+    optional<Request> tryTakeRequest(int car) {
+        if (assignsCars()) return elevators[car]->popInbox();
+        if (queueMode == QueueMode::Local) return takeLocal(car);
+        if (queueMode == QueueMode::LockFree) {
+            Request r;
+            if (ring->tryPop(r)) return r;
+            if (ringOverflow.empty()) return nullopt;
+            r = ringOverflow.front();
+            ringOverflow.pop_front();
+            return r;
+        }
+
+        lock_guard<ProfiledMutex> lk(mtx);
+        return requestQ.popOldest();
+    }
+
+    void pushToRing(const Request& r) {
+        if (eventDriven) {
+            if (!ringOverflow.empty() || !ring->tryPush(r)) ringOverflow.push_back(r);
+            return;
+        }
+        while (!ring->tryPush(r)) this_thread::yield(); // car threads make room
+    }
+
+    void wakeRingSleeper() {
+        // Pairs with the increment in waitOnRing: either we see the sleeper
+        // or its pop after registering sees our push
+        atomic_thread_fence(memory_order_seq_cst);
+        if (sleepers.load(memory_order_relaxed) > 0 && !wakePending.exchange(true)) {
+            wakeSeq.fetch_add(1, memory_order_release);
+            wakeSeq.notify_one();
+        }
+    }
+
+    // Spin briefly, then sleep on wakeSeq. Reading the counter before the
+    // final pop means a push that lands in between changes it and the wait
+    // returns immediately instead of missing the request. wakePending is
+    // cleared on every exit from a wait; clearing too often only costs an
+    // extra notify, never a lost one.
+    optional<Request> waitOnRing() {
+        Request r;
+        for (int i = 0; i < wakeSpinCount; i++) {
+            if (ring->tryPop(r)) return r;
+        }
+        sleepers.fetch_add(1, memory_order_seq_cst);
+        wakePending = false;
+        optional<Request> result;
+        bool counting = profiling.load(memory_order_relaxed);
+        ThreadStats::Wait* stats = counting ? &threadStats().wait(WaitSite::Ring) : nullptr;
+        bool woke = false;
+        chrono::steady_clock::time_point began;
+        for (;;) {
+            uint32_t seen = wakeSeq.load(memory_order_acquire);
+            if (ring->tryPop(r)) {
+                result = r;
+                break;
+            }
+            if (ringClosed) break;
+            if (counting) {
+                if (woke) ThreadStats::bump(stats->spurious);
+                else {
+                    ThreadStats::bump(stats->waits);
+                    began = chrono::steady_clock::now();
+                }
+            }
+            wakeSeq.wait(seen, memory_order_acquire);
+            if (counting) ThreadStats::bump(stats->wakeups);
+            woke = true;
+            wakePending = false;
+        }
+        if (counting && woke) ThreadStats::bump(stats->waitNanos, ThreadStats::nanosSince(began));
+        wakePending = false;
+        sleepers.fetch_sub(1, memory_order_relaxed);
+        if (result && !ring->empty()) wakeRingSleeper();
+        return result;
+    }
+
+    // Waiting calls the car can collect at `floor` heading in `dir`, at most
+    // `room` of them; returns how many it had to leave (see HallCallQueue::claim)
+    size_t claimAt(int car, int floor, int dir, size_t room, PoolVector<Request>& out) {
+        if (queueMode == QueueMode::Local) return elevators[car]->claimFromInbox(floor, dir, room, out);
+        lock_guard<ProfiledMutex> lk(mtx);
+        return requestQ.claim(floor, dir, room, out);
+    }
+
+    // Nearest floor past `floor` and up to `limit` where claimAt would find a
+    // call heading in `dir`, or `limit` if there is none; lets a SCAN car
+    // plan to stop for calls it has not been given
+    int nextCallAhead(int car, int floor, int dir, int limit) {
+        if (queueMode == QueueMode::Local) return elevators[car]->nextCallInInbox(floor, dir, limit);
+        lock_guard<ProfiledMutex> lk(mtx);
+        return requestQ.nextCall(floor, dir, limit);
+    }
+
+    // Adds every car's wait and ride samples to the given histograms
+    void mergeStats(LatencyHistogram& wait, LatencyHistogram& ride) const {
+        for (auto& e : elevators) {
+            wait.mergeFrom(e->stats().wait);
+            ride.mergeFrom(e->stats().ride);
+        }
+    }
+
+    // Merges every car's histograms into a run report
+    RunReport report() const {
+        LatencyHistogram wait, ride;
+        mergeStats(wait, ride);
+        SimTime end = startTime;
+        for (auto& e : elevators) {
+            end = max(end, SimTime(SimDuration(e->stats().lastDropOffNanos.load())));
+        }
+        // Busy time runs on past the last drop-off (doors closing, parking),
+        // so utilization is measured up to the last car going idle
+        SimTime idleEnd = end;
+        for (auto& e : elevators) {
+            idleEnd = max(idleEnd, SimTime(SimDuration(e->stats().lastIdleNanos.load())));
+        }
+        double window = chrono::duration<double>(idleEnd - startTime).count();
+
+        RunReport r;
+        r.allocations = heapAllocations.load(memory_order_relaxed) - allocationsAtStart;
+        r.served = ride.count();
+        r.simSeconds = chrono::duration<double>(end - startTime).count();
+        r.wait = summarize(wait);
+        r.ride = summarize(ride);
+        r.capacity = cars.capacity;
+        r.shutdown = lastShutdown;
+        for (auto& e : elevators) {
+            double busy = chrono::duration<double>(chrono::nanoseconds(e->stats().busyNanos.load())).count();
+            r.utilization.push_back(window > 0 ? busy / window : 0);
+            r.fullStops += e->stats().fullStops.load();
+            r.peakLoad = max(r.peakLoad, e->stats().peakLoad.load());
+            r.stops += e->stats().stops.load();
+            r.energyKwh += e->stats().energyMillijoules.load() / 3.6e9;
+        }
+        return r;
+    }
+};
+
+void printReport(const RunReport& r) {
+    if (r.served == 0) {
+        cout << "No requests served." << endl;
+        return;
+    }
+
+    cout << fixed << setprecision(1)
+         << "Served " << r.served << " requests in " << r.simSeconds << " s";
+    if (r.simSeconds > 0) cout << " (" << setprecision(3) << r.served / r.simSeconds << " req/s)";
+    cout << endl << setprecision(1)
+         << "  (ms)        mean        p50        p90        p99        max" << endl;
+    for (auto [name, l] : { pair<const char*, const LatencySummary*>{ "wait", &r.wait }, { "ride", &r.ride } }) {
+        cout << "  " << name;
+        for (double v : { l->meanMs, l->p50Ms, l->p90Ms, l->p99Ms, l->maxMs }) {
+            cout << ' ' << setw(10) << v;
+        }
+        cout << endl;
+    }
+    if (!r.utilization.empty()) {
+        cout << "Utilization:";
+        for (size_t i = 0; i < r.utilization.size(); i++) {
+            cout << " E" << i << " " << 100 * r.utilization[i] << "%";
+        }
+        cout << endl;
+    }
+    cout << "Stops: " << r.stops << " (" << setprecision(2) << static_cast<double>(r.stops) / r.served
+         << " per request)" << endl;
+    if (r.energyKwh > 0) {
+        cout << "Energy: " << setprecision(2) << r.energyKwh << " kWh (" << 1000 * r.energyKwh / r.served
+             << " Wh per passenger)" << endl;
+    }
+    if (r.capacity > 0) {
+        cout << "Capacity " << r.capacity << ": peak load " << r.peakLoad << ", "
+             << r.fullStops << " stops left calls behind" << endl;
+    }
+    cout << "Heap allocations: " << r.allocations << " (" << setprecision(2)
+         << 1000.0 * r.allocations / r.served << " per 1000 requests)" << endl;
+    if (r.shutdown) {
+        cout << "Shutdown: drained in " << setprecision(3) << r.shutdown->drainSeconds << " s";
+        if (r.shutdown->timedOut) cout << ", deadline hit";
+        cout << ", " << r.shutdown->unserved << " unserved" << endl;
+    }
+    cout.unsetf(ios::floatfield);
+}
+
+// Building member function definitions
+int Building::routeRequest(const Request& r) {
+    if (demand) recordDemand(r);
+    if (assignsCars()) {
+        int best = mode == DispatchMode::Destination ? destinationCar(r, 1) : bestElevatorFor(r);
+        elevators[best]->assign(r);
+        if (eventDriven) fleetTable.load[best]++;
+        return best;
+    }
+    if (queueMode == QueueMode::Local) {
+        int home = homeElevatorFor(r);
+        elevators[home]->assign(r);
+        if (!elevators[home]->isIdle()) nudgeIdleNeighbour(home);
+        return home;
+    }
+    if (queueMode == QueueMode::LockFree) {
+        pushToRing(r);
+        wakeRingSleeper();
+        return -1;
+    }
+    {
+        lock_guard<ProfiledMutex> lk(mtx);
+        requestQ.push(r);
+    }
+    cv.notify_one();
+    return -1;
+}
+
+void Building::save(SnapshotWriter& w) {
+    {
+        lock_guard<ProfiledMutex> lk(mtx);
+        w.put(acceptingRequests);
+        w.put(startTime);
+        w.put(nextRequestId.load(memory_order_relaxed));
+        requestQ.save(w);
+        w.putAll(groups);
+    }
+    // The ring can only be read by popping; put everything back in order.
+    // Overflowed calls are all younger than the ring's and follow them.
+    vector<Request> ringed;
+    if (ring) {
+        for (Request r; ring->tryPop(r);) ringed.push_back(r);
+        for (auto& r : ringed) ring->tryPush(r);
+        ringed.insert(ringed.end(), ringOverflow.begin(), ringOverflow.end());
+    }
+    w.putAll(ringed);
+    w.put(ringClosed.load());
+    for (auto* column : { &fleetTable.floor, &fleetTable.direction, &fleetTable.target, &fleetTable.load }) {
+        w.putAll(*column);
+    }
+    {
+        lock_guard<mutex> lk(demandMtx);
+        w.put(demand.has_value());
+        if (demand) {
+            demand->save(w);
+            w.putAll(parkedAt);
+        }
+    }
+    for (auto& e : elevators) e->save(w);
+}
+
+void Building::restore(SnapshotReader& r) {
+    {
+        lock_guard<ProfiledMutex> lk(mtx);
+        acceptingRequests = r.get<bool>();
+        startTime = r.get<SimTime>();
+        nextRequestId.store(r.get<uint32_t>(), memory_order_relaxed);
+        requestQ.restore(r);
+        size_t groupCount = groups.size();
+        groups.clear();
+        r.getAll<DestinationGroup>(groups);
+        if (groups.size() != groupCount) throw runtime_error("snapshot has the wrong destination groups");
+    }
+    vector<Request> ringed;
+    r.getAll<Request>(ringed);
+    if (!ringed.empty() && !ring) throw runtime_error("snapshot ring does not fit");
+    for (auto& q : ringed) {
+        checkSnapshotCall(q.sourceFloor, q.destFloor, numFloors);
+        pushToRing(q);
+    }
+    ringClosed = r.get<bool>();
+    for (auto* column : { &fleetTable.floor, &fleetTable.direction, &fleetTable.target, &fleetTable.load }) {
+        column->clear();
+        r.getAll<int32_t>(*column);
+        if (column->size() != elevators.size()) throw runtime_error("snapshot has the wrong fleet size");
+    }
+    {
+        lock_guard<mutex> lk(demandMtx);
+        if (r.get<bool>() != demand.has_value()) throw runtime_error("snapshot differs in --preposition");
+        if (demand) {
+            demand->restore(r);
+            parkedAt.clear();
+            r.getAll<int>(parkedAt);
+            if (parkedAt.size() != elevators.size()) throw runtime_error("snapshot has the wrong fleet size");
+            for (int f : parkedAt) {
+                if (f < 0 || f > numFloors) throw runtime_error("snapshot has a car off the building");
+            }
+        }
+    }
+    for (auto& e : elevators) e->restore(r);
+}
+
+// Destination dispatch: a call joins the open group for its source floor,
+// direction and destination band if that car still has seats for it;
+// otherwise it opens a new group on the car with the lowest pickup estimate.
+// Riders sharing a car then have nearby destinations, so trips make fewer stops.
+int Building::destinationCar(const Request& r, int riders) {
+    lock_guard<ProfiledMutex> lk(mtx);
+    DestinationGroup& g = groups[groupOf(r)];
+    if (g.car >= 0 && (cars.capacity <= 0 || g.riders + riders <= cars.capacity)) {
+        g.riders += riders;
+        return g.car;
+    }
+    g.car = bestElevatorFor(r);
+    g.riders = riders;
+    return g.car;
+}
+
+// Called by a car after it stopped at floor: later calls there need a new trip
+void Building::closeGroups(int car, int floor) {
+    lock_guard<ProfiledMutex> lk(mtx);
+    size_t first = static_cast<size_t>(floor - 1) * 2 * destinationBands;
+    for (size_t i = first; i < first + 2 * destinationBands; i++) {
+        if (groups[i].car == car) groups[i] = DestinationGroup{};
+    }
+}
+
+// Wakes the scheduler that can use the call: the routed car's own under ETA,
+// otherwise the next ones round-robin that have a car waiting, one per call
+void Building::notifySchedulers(int car, int calls) {
+    if (car >= 0 && !workStealing()) {
+        CarScheduler* s = schedulerFor(car);
+        if (s->hasWaiters()) s->signal(car);
+        return;
+    }
+    size_t first = nextScheduler.fetch_add(1, memory_order_relaxed);
+    for (size_t k = 0; k < schedulers.size(); k++) {
+        CarScheduler& s = *schedulers[(first + k) % schedulers.size()];
+        if (s.hasWaiters()) {
+            s.signal(-1);
+            if (--calls == 0) return;
+        }
+    }
+}
+
+// Queues a burst of calls in one go. FIFO/SCAN calls take one lock on the
+// shared queue and wake at most as many cars as are waiting; Local calls
+// are grouped by home car, one inbox lock each; destination dispatch groups
+// by (source, destination band) as it would one call at a time. Under ETA the burst is
+// dispatched jointly: calls from the same floor going the same way form one
+// group that is priced once and sent to a single car, so they share its stop.
+// routedTo, if given, receives each call's car as addRequest would return it.
+void Building::addRequests(span<Request> batch, vector<int>* routedTo) {
+    if (routedTo) routedTo->assign(batch.size(), -1);
+    if (batch.empty()) return;
+    number(batch);
+    if (demand) {
+        for (const Request& r : batch) recordDemand(r);
+    }
+
+    if (perCarQueues()) {
+        // (car or group key, index) pairs sorted so each car's calls are contiguous
+        thread_local vector<pair<int64_t, size_t>> order;
+        thread_local vector<Request> run;
+        order.clear();
+        for (size_t i = 0; i < batch.size(); i++) {
+            int64_t key = mode == DispatchMode::Eta ? int64_t(batch[i].sourceFloor) * 2 + (batch[i].direction() > 0)
+                        : mode == DispatchMode::Destination ? groupOf(batch[i])
+                        : homeElevatorFor(batch[i]);
+            order.push_back({ key, i });
+        }
+        sort(order.begin(), order.end());
+
+        for (size_t g = 0; g < order.size();) {
+            size_t end = g;
+            while (end < order.size() && order[end].first == order[g].first) end++;
+            const Request& first = batch[order[g].second];
+            int car = mode == DispatchMode::Eta ? bestElevatorFor(first)
+                    : mode == DispatchMode::Destination ? destinationCar(first, static_cast<int>(end - g))
+                    : homeElevatorFor(first);
+            run.clear();
+            for (size_t k = g; k < end; k++) {
+                run.push_back(batch[order[k].second]);
+                if (routedTo) (*routedTo)[order[k].second] = car;
+            }
+            elevators[car]->assign(run);
+            if (assignsCars() && eventDriven) fleetTable.load[car] += static_cast<int32_t>(run.size());
+            if (workStealing() && !elevators[car]->isIdle()) nudgeIdleNeighbour(car);
+            if (!schedulers.empty()) notifySchedulers(car);
+            g = end;
+        }
+        return;
+    }
+
+    if (queueMode == QueueMode::LockFree) {
+        for (const Request& r : batch) pushToRing(r);
+        wakeRingSleeper(); // the woken car passes the baton while the ring is non-empty
+    }
+    else {
+        int wake;
+        bool all;
+        {
+            lock_guard<ProfiledMutex> lk(mtx);
+            for (const Request& r : batch) requestQ.push(r);
+            wake = static_cast<int>(min<size_t>(batch.size(), waitingCars));
+            all = wake == waitingCars; // waitingCars is only stable under the lock
+        }
+        if (all) cv.notify_all();
+        else {
+            for (int i = 0; i < wake; i++) cv.notify_one();
+        }
+    }
+    if (!schedulers.empty()) notifySchedulers(-1, static_cast<int>(batch.size()));
+}
+
+// Elevator member function definitions
+void Elevator::accept(const Request& r) {
+    pending.push_back(r);
+    addStop(pickupsAt, r.sourceFloor);
+}
+
+void Elevator::addStop(PoolVector<int32_t>& at, int floor) {
+    at[floor]++;
+    stopTotal++;
+    highestStop = max(highestStop, floor);
+    lowestStop = min(lowestStop, floor);
+    // A new stop short of the planned one ends the run there instead
+    int dir = runStop > runStart ? 1 : -1;
+    if (inRun && (floor - currentFloor) * dir > 0 && (runStop - floor) * dir > 0) runStop = floor;
+}
+
+// Narrows the extremes past floors that no longer have a stop; amortized
+// against the additions that widened them
+void Elevator::removeStop(PoolVector<int32_t>& at, int floor) {
+    at[floor]--;
+    if (--stopTotal == 0) {
+        highestStop = 0;
+        lowestStop = INT_MAX;
+        return;
+    }
+    while (pickupsAt[highestStop] + dropOffsAt[highestStop] == 0) highestStop--;
+    while (pickupsAt[lowestStop] + dropOffsAt[lowestStop] == 0) lowestStop++;
+}
+
+void Elevator::assign(const Request& r) {
+    {
+        lock_guard<ProfiledMutex> lk(inboxMtx);
+        inbox.push(r);
+    }
+    inboxCv.notify_one();
+}
+
+void Elevator::assign(span<const Request> batch) {
+    {
+        lock_guard<ProfiledMutex> lk(inboxMtx);
+        for (const Request& r : batch) inbox.push(r);
+    }
+    inboxCv.notify_one();
+}
+
+void Elevator::closeInbox() {
+    {
+        lock_guard<ProfiledMutex> lk(inboxMtx);
+        inboxClosed = true;
+    }
+    inboxCv.notify_all();
+}
+
+optional<Request> Elevator::popInbox(bool fromBack) {
+    lock_guard<ProfiledMutex> lk(inboxMtx);
+    return fromBack ? inbox.popNewest() : inbox.popOldest();
+}
+
+size_t Elevator::claimFromInbox(int floor, int dir, size_t room, PoolVector<Request>& out) {
+    lock_guard<ProfiledMutex> lk(inboxMtx);
+    return inbox.claim(floor, dir, room, out);
+}
+
+size_t Elevator::queuedCalls() const {
+    lock_guard<ProfiledMutex> lk(inboxMtx);
+    return inbox.size();
+}
+
+int Elevator::nextCallInInbox(int floor, int dir, int limit) const {
+    lock_guard<ProfiledMutex> lk(inboxMtx);
+    return inbox.nextCall(floor, dir, limit);
+}
+
+// Blocks until the inbox has work, a producer nudged the car to go stealing,
+// or the inbox was closed; returns false only in the last case
+bool Elevator::waitForWork() {
+    unique_lock<mutex> lk = inboxMtx.acquire();
+    countedWait(WaitSite::Inbox, inboxCv, lk, [&] { return !inbox.empty() || stealHint || inboxClosed; });
+    bool more = !inbox.empty() || stealHint;
+    stealHint = false;
+    return more;
+}
+
+void Elevator::nudge() {
+    {
+        lock_guard<ProfiledMutex> lk(inboxMtx);
+        stealHint = true;
+    }
+    inboxCv.notify_one();
+}
+
+// Travel time to r's source floor: direct if the car is idle or already heading
+// there in r's direction, otherwise via the far end of its current sweep.
+// Every stop the car still has to make is charged on top.
+SimDuration Elevator::estimatePickup(const Request& r) const {
+    lock_guard<ProfiledMutex> lk(inboxMtx);
+    int floors;
+    if (route.direction == 0) {
+        floors = abs(r.sourceFloor - route.floor);
+    }
+    else if (route.direction == r.direction() && (r.sourceFloor - route.floor) * route.direction > 0) {
+        floors = abs(r.sourceFloor - route.floor);
+    }
+    else {
+        floors = abs(route.turnFloor - route.floor) + abs(route.turnFloor - r.sourceFloor);
+    }
+    int stops = route.stops + static_cast<int>(inbox.size());
+    const MotionModel& m = building->motion();
+    return floors * m.travelEstimate() + stops * m.stopEstimate();
+}
+
+// Republishes only when position, direction or the stop set changed, so a
+// waiting or dwelling car costs its readers nothing
+void Elevator::publishRoute() {
+    RouteSummary s;
+    s.floor = currentFloor;
+    s.direction = direction;
+    s.stops = stopTotal;
+    s.turnFloor = direction > 0 && stopTotal && highestStop > currentFloor ? highestStop
+                : direction < 0 && stopTotal && lowestStop < currentFloor ? lowestStop : currentFloor;
+    if (s.floor == published.floor && s.direction == published.direction && s.stops == published.stops &&
+        s.turnFloor == published.turnFloor) {
+        return;
+    }
+    published = s;
+    lock_guard<ProfiledMutex> lk(inboxMtx);
+    route = s;
+    if (building->isEventDriven()) building->fleet().publish(id, s, static_cast<int>(inbox.size()));
+}
+
+// LOOK: keep the current direction while there are stops ahead, otherwise
+// turn around; an idle car heads for its oldest request first
+int Elevator::chooseDirection() const {
+    bool up = stopTotal && highestStop > currentFloor;
+    bool down = stopTotal && lowestStop < currentFloor;
+    if (direction > 0 && up) return 1;
+    if (direction < 0 && down) return -1;
+    if (up != down) return up ? 1 : -1;
+    if (!up) return 0;
+    int first = !pending.empty() ? pending.front().sourceFloor : riders.front().request.destFloor;
+    return first > currentFloor ? 1 : -1;
+}
+
+// Drops off, boards assigned requests and, in SCAN mode, collects every
+// waiting call at this floor going the way the car will leave
+SimDuration Elevator::serveFloor() {
+    if (building->assignsCars()) {
+        lock_guard<ProfiledMutex> lk(inboxMtx);
+        inbox.drain([&](const Request& r) {
+            addStop(pickupsAt, r.sourceFloor);
+            pending.push_back(r);
+        });
+    }
+
+    SimTime now = building->clock().now();
+    size_t before = riders.size();
+    for (auto it = riders.begin(); dropOffsAt[currentFloor] > 0 && it != riders.end();) {
+        if (it->request.destFloor == currentFloor) {
+            log<LogEvent::DropOff>(currentFloor);
+            EventLog::instance().record(CarEvent::DropOff, id, currentFloor, it->request.id, now);
+            auto ms = chrono::duration_cast<chrono::milliseconds>(now - it->request.timestamp).count();
+            log<LogEvent::RequestTime>(ms);
+            carStats.ride.record(now - it->boardedAt);
+            carStats.lastDropOffNanos.store(chrono::duration_cast<chrono::nanoseconds>(now.time_since_epoch()).count(),
+                                            memory_order_relaxed);
+            removeStop(dropOffsAt, currentFloor);
+            building->droppedOff(it->request, now);
+            it = riders.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+
+    // Calls continuing the current sweep board first; if the car then turns
+    // around here, calls going the new way board too. The rest wait for it to come back.
+    size_t alighted = before - riders.size();
+    leftBehind = false;
+    if (direction != 0) boardAt(direction);
+    boardAt(chooseDirection());
+    size_t boarded = riders.size() - (before - alighted);
+    if (leftBehind) carStats.fullStops.fetch_add(1, memory_order_relaxed);
+    if (alighted || boarded) carStats.stops.fetch_add(1, memory_order_relaxed);
+    if (building->dispatchMode() == DispatchMode::Destination && (boarded || leftBehind)) {
+        building->closeGroups(id, currentFloor);
+    }
+
+    const CarSpec& spec = building->carSpec();
+    SimDuration dwell = static_cast<int64_t>(alighted) * spec.alightTime + static_cast<int64_t>(boarded) * spec.boardTime;
+    if (alighted || boarded) {
+        // Whether planned or not, the car stood still here
+        if (inRun) endRun();
+        dwell += spec.doorOpenTime + spec.doorCloseTime;
+    }
+    return dwell;
+}
+
+void Elevator::save(SnapshotWriter& w) const {
+    w.put(currentFloor);
+    w.put(direction);
+    w.put(moving);
+    w.put(busy);
+    w.put(leftBehind);
+    w.put(inRun);
+    w.put(runStart);
+    w.put(runStop);
+    w.put(runLoad);
+    w.put(parkFloor);
+    w.put(busySince);
+    w.putAll(pending);
+    w.putAll(riders);
+    w.put(published);
+    w.put(idle.load());
+    {
+        lock_guard<ProfiledMutex> lk(inboxMtx);
+        inbox.save(w);
+        w.put(inboxClosed);
+        w.put(stealHint);
+        w.put(route);
+    }
+    carStats.wait.save(w);
+    carStats.ride.save(w);
+    w.put(carStats.busyNanos.load());
+    w.put(carStats.lastDropOffNanos.load());
+    w.put(carStats.lastIdleNanos.load());
+    w.put(carStats.fullStops.load());
+    w.put(carStats.peakLoad.load());
+    w.put(carStats.stops.load());
+    w.put(carStats.energyMillijoules.load());
+}
+
+void Elevator::restore(SnapshotReader& r) {
+    currentFloor = r.get<int>();
+    direction = r.get<int>();
+    moving = r.get<bool>();
+    busy = r.get<bool>();
+    leftBehind = r.get<bool>();
+    inRun = r.get<bool>();
+    runStart = r.get<int>();
+    runStop = r.get<int>();
+    runLoad = r.get<int>();
+    parkFloor = r.get<int>();
+    busySince = r.get<SimTime>();
+    r.getAll<Request>(pending);
+    r.getAll<Rider>(riders);
+    auto inRange = [&](int f) { return f >= 1 && f <= building->floors(); };
+    if (!inRange(currentFloor) || !inRange(runStart) || !inRange(runStop) || (parkFloor && !inRange(parkFloor))) throw runtime_error("snapshot has a car off the building");
+    for (auto& q : pending) {
+        checkSnapshotCall(q.sourceFloor, q.destFloor, building->floors());
+        addStop(pickupsAt, q.sourceFloor);
+    }
+    for (auto& rider : riders) {
+        checkSnapshotCall(rider.request.sourceFloor, rider.request.destFloor, building->floors());
+        addStop(dropOffsAt, rider.request.destFloor);
+    }
+    published = r.get<RouteSummary>();
+    idle = r.get<bool>();
+    {
+        lock_guard<ProfiledMutex> lk(inboxMtx);
+        inbox.restore(r);
+        inboxClosed = r.get<bool>();
+        stealHint = r.get<bool>();
+        route = r.get<RouteSummary>();
+    }
+    carStats.wait.restore(r);
+    carStats.ride.restore(r);
+    carStats.busyNanos = r.get<int64_t>();
+    carStats.lastDropOffNanos = r.get<int64_t>();
+    carStats.lastIdleNanos = r.get<int64_t>();
+    carStats.fullStops = r.get<uint64_t>();
+    carStats.peakLoad = r.get<int>();
+    carStats.stops = r.get<uint64_t>();
+    carStats.energyMillijoules = r.get<uint64_t>();
+}
+
+// Free places on board; effectively unlimited without a capacity
+size_t Elevator::room() const {
+    int capacity = building->carSpec().capacity;
+    if (capacity <= 0) return SIZE_MAX;
+    return riders.size() < static_cast<size_t>(capacity) ? capacity - riders.size() : 0;
+}
+
+// Boards the calls at this floor heading in dir (any single direction if
+// dir == 0) while there is room; the rest stay pending until the car returns
+void Elevator::boardAt(int dir) {
+    for (auto it = pending.begin(); pickupsAt[currentFloor] > 0 && it != pending.end();) {
+        if (it->sourceFloor == currentFloor && (dir == 0 || it->direction() == dir)) {
+            dir = it->direction();
+            if (room() == 0) {
+                leftBehind = true;
+                ++it;
+                continue;
+            }
+            removeStop(pickupsAt, currentFloor);
+            board(*it);
+            it = pending.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+
+    if (building->dispatchMode() == DispatchMode::Scan) {
+        claimed.clear();
+        size_t left = building->claimAt(id, currentFloor, dir, room(), claimed);
+        if (left) leftBehind = true;
+        for (auto& r : claimed) {
+            board(r);
+        }
+    }
+}
+
+void Elevator::board(const Request& r) {
+    SimTime now = building->clock().now();
+    log<LogEvent::PickUp>(currentFloor);
+    EventLog::instance().record(CarEvent::PickUp, id, currentFloor, r.id, now);
+    carStats.wait.record(now - r.timestamp);
+    riders.push_back({ r, now });
+    addStop(dropOffsAt, r.destFloor);
+    if (static_cast<int>(riders.size()) > carStats.peakLoad.load(memory_order_relaxed)) {
+        carStats.peakLoad.store(static_cast<int>(riders.size()), memory_order_relaxed);
+    }
+}
+
+// Runs everything that happens at the current instant and returns how long
+// until the car needs to be stepped again, or nullopt once it is idle.
+// A floor move is started here and completes at the beginning of the next
+// step; door dwell for the passengers served here comes before it.
+optional<SimDuration> Elevator::step() {
+    if (moving) {
+        currentFloor += direction;
+        moving = false;
+        log<LogEvent::PassingFloor>(currentFloor);
+        EventLog& events = EventLog::instance();
+        if (events.active()) events.record(CarEvent::PassFloor, id, currentFloor, 0, building->clock().now());
+        if (inRun && currentFloor == runStop) endRun();
+    }
+
+    SimDuration dwell = serveFloor();
+
+    direction = chooseDirection();
+    if (direction == 0 && building->prepositions()) {
+        direction = parkingDirection();
+    }
+    else if (direction != 0 && parkFloor) {
+        parkFloor = 0;
+        building->leaveParking(id);
+    }
+    if (inRun && direction != (runStop > runStart ? 1 : -1)) endRun(); // stops to turn or rest
+    publishRoute();
+
+    // Utilization: a car is busy from the step it gets work until it goes idle
+    SimTime now = building->clock().now();
+    bool wasBusy = busy;
+    busy = direction != 0 || dwell > SimDuration::zero();
+    if (!wasBusy && busy) {
+        busySince = now;
+    }
+    else if (wasBusy && !busy) {
+        carStats.busyNanos.fetch_add(chrono::duration_cast<chrono::nanoseconds>(now - busySince).count(),
+                                     memory_order_relaxed);
+        carStats.lastIdleNanos.store(chrono::duration_cast<chrono::nanoseconds>(now.time_since_epoch()).count(),
+                                     memory_order_relaxed);
+    }
+    if (!busy) return nullopt;
+    if (direction == 0) return dwell; // doors close, then the car goes idle
+
+    moving = true;
+    return dwell + travel();
+}
+
+// Time to the next floor. Leaving from rest starts a run to the nearest stop
+// ahead; on the way, a nearer stop assigned to the car (addStop) or, under
+// SCAN, a call waiting in its path cuts the run short. A stop the car could
+// not foresee when it committed to the floor it is entering is served as if
+// it braked within that floor.
+SimDuration Elevator::travel() {
+    const MotionModel& m = building->motion();
+    if (!m.isKinematic()) return floorTravelTime;
+    if (!inRun) {
+        inRun = true;
+        runStart = currentFloor;
+        runLoad = static_cast<int>(riders.size());
+        int last = direction > 0 ? highestStop : lowestStop;
+        if (stopTotal == 0 || (last - currentFloor) * direction <= 0) last = parkFloor;
+        for (runStop = currentFloor + direction; runStop != last; runStop += direction) {
+            if (pickupsAt[runStop] > 0 || dropOffsAt[runStop] > 0) break;
+        }
+    }
+    if (building->dispatchMode() == DispatchMode::Scan && room() > 0) {
+        runStop = building->nextCallAhead(id, currentFloor, direction, runStop);
+    }
+    return m.floorTime(abs(runStop - runStart), abs(currentFloor - runStart));
+}
+
+// Out of work: head for the floor the building expects to call next, unless
+// a call is already waiting, in which case the car stops here to take it
+int Elevator::parkingDirection() {
+    if (parkFloor == 0) parkFloor = building->parkingFloorFor(id, currentFloor);
+    if (parkFloor == currentFloor || building->hasWaitingCall(id)) return 0;
+    return parkFloor > currentFloor ? 1 : -1;
+}
+
+void Elevator::endRun() {
+    int floors = abs(currentFloor - runStart);
+    double joules = building->motion().runEnergy(floors, currentFloor > runStart ? 1 : -1, runLoad);
+    carStats.energyMillijoules.fetch_add(static_cast<uint64_t>(joules * 1000), memory_order_relaxed);
+    inRun = false;
+}
+
+void Elevator::process(const Request& r) {
+    accept(r);
+    while (auto d = step()) {
+        building->clock().sleepFor(*d);
+    }
+}
+
+void Elevator::run() {
+    ThreadRegistry::instance().nameThread("car " + to_string(id));
+    while (running) {
+        auto req = building->waitForRequest(id);
+        if (!req) break;
+        process(*req);
+    }
+    building->carStopped();
+}
+
+Elevator::Elevator(int id, Building* b)
+    : id(id), building(b), pending(PoolAllocator<Request>(stopPool)), riders(PoolAllocator<Rider>(stopPool)),
+      claimed(PoolAllocator<Request>(stopPool)), pickupsAt(b->floors() + 1, 0, PoolAllocator<int32_t>(stopPool)),
+      dropOffsAt(b->floors() + 1, 0, PoolAllocator<int32_t>(stopPool)), inbox(b->floors(), inboxPool) {
+    published.floor = -1; // force the first publish
+}
+
+Elevator::~Elevator() {
+    if (thr.joinable()) {
+        thr.join();
+    }
+}
+
+// Coroutine counterpart of run(): suspends instead of blocking
+CarTask Elevator::runAsync(CarScheduler& s) {
+    while (running) {
+        idle = true;
+        auto req = co_await s.nextRequest(id);
+        idle = false;
+        if (!req) break;
+        accept(*req);
+        while (auto d = step()) {
+            co_await s.travel(*d);
+        }
+    }
+    building->carStopped();
+}
+
+void Elevator::start() {
+    if (CarScheduler* s = building->schedulerFor(id)) s->spawn(id, runAsync(*s));
+    else thr = thread(&Elevator::run, this);
+}
+
+void Elevator::stop() {
+    abandon();
+    building->stopAcceptingRequests(); // Ensure wake up
+    join();
+}
+
+void Elevator::join() {
+    if (thr.joinable()) {
+        thr.join();
+    }
+    else if (CarScheduler* s = building->schedulerFor(id)) {
+        s->waitFor(id);
+    }
+}
+
+// Closes intake for every car at once, so they drain the queues in parallel
+// and the run ends when the slowest car does rather than after each car in
+// turn. Past a nonzero deadline the cars finish the call in hand and stop;
+// whatever is still queued then is reported as unserved.
+ShutdownReport Building::shutdown(chrono::milliseconds deadline) {
+    ShutdownReport s;
+    auto began = chrono::steady_clock::now();
+    stopAcceptingRequests();
+    {
+        unique_lock<mutex> lk = mtx.acquire();
+        auto drained = [&] { return carsRunning <= 0; };
+        if (deadline > chrono::milliseconds::zero()) s.timedOut = !drainedCv.wait_for(lk, deadline, drained);
+        else drainedCv.wait(lk, drained);
+    }
+    if (s.timedOut) {
+        for (auto& e : elevators) e->abandon();
+    }
+    for (auto& e : elevators) e->join();
+    s.drainSeconds = chrono::duration<double>(chrono::steady_clock::now() - began).count();
+    s.unserved = queuedRequests();
+    lastShutdown = s;
+    return s;
+}
+
+// Hottest floor no other car is parked at or heading for, else the car's own floor
+int Building::parkingFloorFor(int car, int floor) {
+    lock_guard<mutex> lk(demandMtx);
+    thread_local vector<char> covered;
+    covered.assign(numFloors + 1, 0);
+    for (int f : parkedAt) covered[f] = 1;
+    int hot = demand->hottest(simClock.now() - startTime, covered);
+    parkedAt[car] = hot ? hot : floor;
+    return parkedAt[car];
+}
+
+// Whether a call is already waiting for the car, so it should not go parking
+bool Building::hasWaitingCall(int car) {
+    if (perCarQueues()) return elevators[car]->queuedCalls() > 0;
+    if (queueMode == QueueMode::LockFree) return !ring->empty() || !ringOverflow.empty();
+    lock_guard<ProfiledMutex> lk(mtx);
+    return !requestQ.empty();
+}
+
+// Non-destructive count of calls no car has taken yet (MetricsExporter)
+size_t Building::waitingCalls() {
+    size_t n = 0;
+    if (perCarQueues()) {
+        for (auto& e : elevators) n += e->queuedCalls();
+    }
+    else if (queueMode == QueueMode::LockFree) {
+        n = ring->sizeApprox();
+    }
+    else {
+        lock_guard<ProfiledMutex> lk(mtx);
+        n = requestQ.size();
+    }
+    return n;
+}
+
+// Calls left in whichever queues the mode uses; only meaningful once the cars have stopped
+uint64_t Building::queuedRequests() {
+    uint64_t n = 0;
+    if (perCarQueues()) {
+        for (auto& e : elevators) {
+            while (e->popInbox()) n++;
+        }
+    }
+    else if (queueMode == QueueMode::LockFree) {
+        Request r;
+        while (ring->tryPop(r)) n++;
+        n += ringOverflow.size();
+        ringOverflow.clear();
+    }
+    else {
+        lock_guard<ProfiledMutex> lk(mtx);
+        n = requestQ.size();
+    }
+    return n;
+}
+
+// CarScheduler member function definitions
+bool CarScheduler::RequestAwaiter::await_ready() {
+    result = scheduler.building.tryTakeRequest(car);
+    return result.has_value();
+}
+
+// Registers as waiting before a last look at the queue, so a producer that
+// pushed in between either sees the count or its call is found here
+bool CarScheduler::RequestAwaiter::await_suspend(coroutine_handle<> h) {
+    scheduler.waitingCount.fetch_add(1, memory_order_seq_cst);
+    if ((result = scheduler.building.tryTakeRequest(car))) {
+        scheduler.waitingCount.fetch_sub(1, memory_order_relaxed);
+        return false;
+    }
+    scheduler.waiters.push_back({ this, h });
+    return true;
+}
+
+void CarScheduler::TravelAwaiter::await_suspend(coroutine_handle<> h) {
+    scheduler.timers.push({ scheduler.building.clock().now() + duration, scheduler.nextSeq++, h });
+}
+
+CarScheduler::CarScheduler(Building& b, int cars) : building(b), spawned(cars), done(cars) {
+    thr = thread(&CarScheduler::loop, this);
+}
+
+CarScheduler::~CarScheduler() {
+    {
+        lock_guard<mutex> lk(mtx);
+        closing = true;
+    }
+    cv.notify_one();
+    thr.join();
+    for (auto& [car, task] : tasks) task.handle.destroy();
+    for (auto& [car, task] : incoming) task.handle.destroy();
+}
+
+void CarScheduler::spawn(int car, CarTask task) {
+    {
+        lock_guard<mutex> lk(mtx);
+        spawned[car] = true;
+        incoming.push_back({ car, task });
+    }
+    cv.notify_one();
+}
+
+void CarScheduler::signal(int car) {
+    {
+        lock_guard<mutex> lk(mtx);
+        if (car >= 0) hints.push_back(car);
+        else sharedHint = true;
+    }
+    cv.notify_one();
+}
+
+// Blocks until the car's coroutine has returned (at once if it never started)
+void CarScheduler::waitFor(int car) {
+    unique_lock<mutex> lk(mtx);
+    doneCv.wait(lk, [&] { return !spawned[car] || done[car] || closing; });
+}
+
+void CarScheduler::loop() {
+    static atomic<int> started{ 0 };
+    ThreadRegistry::instance().nameThread("scheduler " + to_string(started++));
+    for (;;) {
+        vector<pair<int, CarTask>> started;
+        vector<int> hinted;
+        bool shared;
+        {
+            unique_lock<mutex> lk(mtx);
+            auto ready = [&] { return closing || sharedHint || !hints.empty() || !incoming.empty(); };
+            if (!ready() && !profiling.load(memory_order_relaxed)) {
+                if (timers.empty()) cv.wait(lk, ready);
+                else cv.wait_until(lk, timers.top().at, ready);
+            }
+            else if (!ready()) {
+                ThreadStats::Wait& stats = threadStats().wait(WaitSite::Scheduler);
+                ThreadStats::bump(stats.waits);
+                auto began = chrono::steady_clock::now();
+                for (;;) {
+                    bool timedOut = false;
+                    if (timers.empty()) cv.wait(lk);
+                    else timedOut = cv.wait_until(lk, timers.top().at) == cv_status::timeout;
+                    ThreadStats::bump(stats.wakeups);
+                    if (timedOut || ready()) break;
+                    ThreadStats::bump(stats.spurious);
+                }
+                ThreadStats::bump(stats.waitNanos, ThreadStats::nanosSince(began));
+            }
+            if (closing) return;
+            swap(started, incoming);
+            swap(hinted, hints);
+            shared = exchange(sharedHint, false);
+        }
+
+        for (auto& t : started) {
+            tasks.push_back(t);
+            t.second.handle.resume();
+        }
+        SimTime now = building.clock().now();
+        while (!timers.empty() && timers.top().at <= now) {
+            auto h = timers.top().handle;
+            timers.pop();
+            h.resume();
+        }
+        pollWaiters(hinted, shared);
+        reap();
+    }
+}
+
+// Hands calls to waiting cars. A call routed to one car (ETA) only wakes that
+// car; otherwise waiting cars take from the shared queue (or steal) in turn
+// until it runs dry. Once the building stops accepting requests every waiter
+// gets one last try and is then resumed empty-handed.
+void CarScheduler::pollWaiters(const vector<int>& hinted, bool shared) {
+    if (waiters.empty()) return;
+    bool anyCar = shared || !building.perCarQueues() || building.workStealing();
+    bool accepting = building.isAcceptingRequests();
+    if (accepting && !anyCar && hinted.empty()) return;
+
+    vector<Waiter> current;
+    swap(current, waiters);
+    vector<Waiter> resumed;
+    bool dry = false;
+    for (auto& w : current) {
+        int car = w.awaiter->car;
+        bool eligible = !accepting || (anyCar ? !dry : find(hinted.begin(), hinted.end(), car) != hinted.end());
+        if (eligible) {
+            if ((w.awaiter->result = building.tryTakeRequest(car)) || !accepting) {
+                resumed.push_back(w);
+                continue;
+            }
+            dry = true;
+        }
+        waiters.push_back(w);
+    }
+    waitingCount.fetch_sub(static_cast<int>(resumed.size()), memory_order_relaxed);
+    for (auto& w : resumed) w.handle.resume();
+}
+
+void CarScheduler::reap() {
+    bool any = false;
+    for (auto it = tasks.begin(); it != tasks.end();) {
+        if (!it->second.handle.done()) {
+            ++it;
+            continue;
+        }
+        it->second.handle.destroy();
+        {
+            lock_guard<mutex> lk(mtx);
+            done[it->first] = true;
+        }
+        any = true;
+        it = tasks.erase(it);
+    }
+    if (any) doneCv.notify_all();
+}
+
+// A call as produced by a request source, timed from the start of the run
+struct Arrival {
+    SimDuration offset;
+    int sourceFloor;
+    int destFloor;
+    uint32_t tag = 0; // copied to the Request
+};
+
+// Stream of arrivals in non-decreasing offset order
+class RequestSource {
+public:
+    virtual ~RequestSource() = default;
+    virtual optional<Arrival> next() = 0;
+    // True while an empty next() only means "nothing yet": the source is fed
+    // as the run goes, and the simulator waits for resumeArrivals() instead
+    // of closing intake
+    virtual bool feeding() const { return false; }
+
+    // Checkpointing (see SnapshotWriter); sources that can't resume midway throw
+    virtual void save(SnapshotWriter&) const { throw logic_error("this request source cannot be checkpointed"); }
+    virtual void restore(SnapshotReader&) { throw logic_error("this request source cannot be checkpointed"); }
+};
+
+// xoshiro256** (Blackman & Vigna): 32 bytes of state and much faster than
+// mt19937_64. Each generator owns one, so there is no shared RNG state
+// between threads. Meets UniformRandomBitGenerator for <random>.
+class Xoshiro256 {
+private:
+    uint64_t state[4];
+
+    static uint64_t splitMix(uint64_t& x) {
+        uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+public:
+    using result_type = uint64_t;
+
+    // Distinct streams from one seed, e.g. one per generator thread
+    explicit Xoshiro256(uint64_t seed, uint64_t stream = 0) {
+        uint64_t x = seed ^ (stream * 0xd1b54a32d192ed03ULL);
+        for (auto& w : state) w = splitMix(x);
+    }
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return ~0ULL; }
+
+    result_type operator()() {
+        uint64_t result = rotl(state[1] * 5, 7) * 9;
+        uint64_t t = state[1] << 17;
+        state[2] ^= state[0];
+        state[3] ^= state[1];
+        state[1] ^= state[2];
+        state[0] ^= state[3];
+        state[2] ^= t;
+        state[3] = rotl(state[3], 45);
+        return result;
+    }
+
+    // Uniform in [0, 1)
+    double uniform() { return static_cast<double>((*this)() >> 11) * 0x1.0p-53; }
+
+    void save(SnapshotWriter& w) const {
+        for (uint64_t word : state) w.put(word);
+    }
+
+    void restore(SnapshotReader& r) {
+        for (auto& word : state) word = r.get<uint64_t>();
+    }
+};
+
+enum class TrafficProfile {
+    Uniform,  // any floor to any floor
+    UpPeak,   // morning: most calls from the lobby to upper floors
+    DownPeak, // evening: most calls from upper floors to the lobby
+};
+
+enum class ArrivalProcess {
+    Fixed,   // one call every 1/rate seconds
+    Poisson, // exponential gaps with mean 1/rate
+};
+
+struct TrafficConfig {
+    TrafficProfile profile = TrafficProfile::Uniform;
+    ArrivalProcess arrivals = ArrivalProcess::Fixed;
+    double ratePerSecond = 1.0;
+    double lobbyShare = 0.85; // fraction of peak calls that start or end at floor 1
+    vector<pair<int, double>> hotFloors; // floor and weight multiplier
+};
+
+// Samples floors from per-floor weights by binary search over their CDF
+class FloorSampler {
+private:
+    vector<double> cdf; // cdf[i] covers floors 1..i+1
+
+public:
+    explicit FloorSampler(const vector<double>& weights) {
+        double total = 0;
+        for (double w : weights) cdf.push_back(total += w);
+    }
+
+    int sample(Xoshiro256& rng) const {
+        double u = rng.uniform() * cdf.back();
+        return static_cast<int>(upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin()) + 1;
+    }
+};
+
+// Synthetic traffic: profile-shaped floors, fixed or Poisson arrivals
+class SyntheticSource : public RequestSource {
+private:
+    TrafficConfig cfg;
+    long long remaining;
+    int maxFloor;
+    Xoshiro256 rng;
+    FloorSampler anyFloor;
+    FloorSampler upperFloor; // floors 2..maxFloor, for lobby trips
+    SimDuration nextOffset{};
+
+    static vector<double> floorWeights(const TrafficConfig& cfg, int maxFloor, bool includeLobby) {
+        vector<double> w(maxFloor, 1.0);
+        for (auto& [floor, weight] : cfg.hotFloors) {
+            if (floor >= 1 && floor <= maxFloor) w[floor - 1] *= weight;
+        }
+        if (!includeLobby) w[0] = 0;
+        return w;
+    }
+
+public:
+    SyntheticSource(const TrafficConfig& cfg, long long numRequests, int maxFloor, uint64_t seed, uint64_t stream = 0)
+        : cfg(cfg), remaining(numRequests), maxFloor(maxFloor), rng(seed, stream),
+          anyFloor(floorWeights(cfg, maxFloor, true)), upperFloor(floorWeights(cfg, maxFloor, false)) {}
+
+    optional<Arrival> next() override {
+        if (remaining <= 0) return nullopt;
+        remaining--;
+
+        int source, dest;
+        bool lobbyTrip = cfg.profile != TrafficProfile::Uniform && rng.uniform() < cfg.lobbyShare;
+        if (lobbyTrip && cfg.profile == TrafficProfile::UpPeak) {
+            source = 1;
+            dest = upperFloor.sample(rng);
+        }
+        else if (lobbyTrip) {
+            source = upperFloor.sample(rng);
+            dest = 1;
+        }
+        else {
+            source = anyFloor.sample(rng);
+            do dest = anyFloor.sample(rng);
+            while (dest == source);
+        }
+
+        Arrival a = { nextOffset, source, dest };
+        double gap = cfg.arrivals == ArrivalProcess::Poisson ? -log1p(-rng.uniform()) / cfg.ratePerSecond
+                                                             : 1.0 / cfg.ratePerSecond;
+        nextOffset += chrono::duration_cast<SimDuration>(chrono::duration<double>(gap));
+        return a;
+    }
+
+    // Traffic and floors come from the constructor; only the stream position is saved
+    void save(SnapshotWriter& w) const override {
+        w.put(remaining);
+        w.put(nextOffset);
+        rng.save(w);
+    }
+
+    void restore(SnapshotReader& r) override {
+        remaining = r.get<long long>();
+        nextOffset = r.get<SimDuration>();
+        rng.restore(r);
+    }
+
+    // Continues from here on a different random stream, e.g. to fork trials from one snapshot
+    void reseed(uint64_t seed) { rng = Xoshiro256(seed); }
+};
+
+// Replays a recorded trace: one call per line as "<time_s> <source> <dest>"
+// (spaces, tabs or commas; '#' starts a comment line). Times are seconds and
+// may be fractional; offsets are taken relative to the first record.
+// The file is memory-mapped and parsed as it is consumed, and pages already
+// read are dropped so even very large traces stay out of resident memory.
+class TraceSource : public RequestSource {
+private:
+    static constexpr size_t releaseChunk = 64 << 20;
+
+    const char* data = nullptr;
+    size_t size = 0;
+    size_t pos = 0;
+    size_t released = 0;
+    long long lineNo = 0;
+    int maxFloor;
+    optional<double> firstTime;
+    double lastTime = 0;
+    string path;
+
+    [[noreturn]] void fail(const string& why) const {
+        throw runtime_error(path + ":" + to_string(lineNo) + ": " + why);
+    }
+
+    void skipSeparators(const char*& p, const char* end) const {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ',' || *p == '\r')) p++;
+    }
+
+    void releaseConsumed() {
+        size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size_t upTo = pos / page * page;
+        if (upTo - released >= releaseChunk) {
+            madvise(const_cast<char*>(data) + released, upTo - released, MADV_DONTNEED);
+            released = upTo;
+        }
+    }
+
+public:
+    TraceSource(const string& path, int maxFloor) : maxFloor(maxFloor), path(path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw runtime_error("cannot open trace " + path);
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            throw runtime_error("cannot stat trace " + path);
+        }
+        size = static_cast<size_t>(st.st_size);
+        if (size > 0) {
+            void* m = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (m == MAP_FAILED) {
+                close(fd);
+                throw runtime_error("cannot map trace " + path);
+            }
+            data = static_cast<const char*>(m);
+            madvise(m, size, MADV_SEQUENTIAL);
+        }
+        close(fd);
+    }
+
+    ~TraceSource() override {
+        if (data) munmap(const_cast<char*>(data), size);
+    }
+
+    TraceSource(const TraceSource&) = delete;
+    TraceSource& operator=(const TraceSource&) = delete;
+
+    optional<Arrival> next() override {
+        const char* end = data + size;
+        while (pos < size) {
+            const char* p = data + pos;
+            const char* eol = static_cast<const char*>(memchr(p, '\n', size - pos));
+            if (!eol) eol = end;
+            pos = static_cast<size_t>(eol - data) + 1;
+            lineNo++;
+
+            skipSeparators(p, eol);
+            if (p == eol || *p == '#') continue;
+
+            double t;
+            int source, dest;
+            auto r = from_chars(p, eol, t);
+            if (r.ec != errc()) fail("bad timestamp");
+            p = r.ptr;
+            skipSeparators(p, eol);
+            auto r2 = from_chars(p, eol, source);
+            if (r2.ec != errc()) fail("bad source floor");
+            p = r2.ptr;
+            skipSeparators(p, eol);
+            auto r3 = from_chars(p, eol, dest);
+            if (r3.ec != errc()) fail("bad destination floor");
+
+            if (source < 1 || source > maxFloor || dest < 1 || dest > maxFloor) fail("floor out of range");
+            if (source == dest) fail("source and destination are the same floor");
+            // Offsets count from the first record, which may be negative; the
+            // largest one must still fit in SimDuration
+            if (!isfinite(t)) fail("bad timestamp");
+            if (firstTime && t < lastTime) fail("timestamps go backwards");
+            if (!firstTime) firstTime = t;
+            if (t - *firstTime >= chrono::duration<double>(SimDuration::max()).count()) {
+                fail("timestamp too far after the first");
+            }
+            lastTime = t;
+
+            releaseConsumed();
+            auto offset = chrono::duration_cast<SimDuration>(chrono::duration<double>(t - *firstTime));
+            return Arrival{ offset, source, dest };
+        }
+        return nullopt;
+    }
+
+    void save(SnapshotWriter& w) const override {
+        w.put(static_cast<uint64_t>(size));
+        w.put(static_cast<uint64_t>(pos));
+        w.put(lineNo);
+        w.put(firstTime.has_value());
+        w.put(firstTime.value_or(0));
+        w.put(lastTime);
+    }
+
+    void restore(SnapshotReader& r) override {
+        if (r.get<uint64_t>() != size) throw runtime_error("snapshot was taken on a different trace than " + path);
+        pos = static_cast<size_t>(r.get<uint64_t>());
+        lineNo = r.get<long long>();
+        bool hasFirst = r.get<bool>();
+        double first = r.get<double>();
+        if (hasFirst) firstTime = first;
+        lastTime = r.get<double>();
+        if (pos > size + 1) throw runtime_error("snapshot trace position is past the end of " + path);
+    }
+};
+
+// Request generator: feeds the source into the building in real time
+void requestGenerator(Building& b, RequestSource& source) {
+    SimTime start = b.clock().now();
+    vector<Request> burst;
+    optional<Arrival> a = source.next();
+    while (a) {
+        SimDuration wait = start + a->offset - b.clock().now();
+        if (wait > SimDuration::zero()) b.clock().sleepFor(wait);
+        // Everything already due goes in as one batch
+        SimTime now = b.clock().now();
+        burst.clear();
+        do {
+            burst.push_back({ a->sourceFloor, a->destFloor, now });
+        } while ((a = source.next()) && start + a->offset <= now);
+        b.addRequests(burst);
+    }
+    b.stopAcceptingRequests();
+}
+
+// Periodic dump of the contention counters (ThreadStats), queue depth and
+// per-car idle time in Prometheus text exposition format. The file is
+// replaced atomically every interval and once more on stop(), so a
+// node_exporter textfile collector (or a person with cat) can read it while
+// the run is live. Wall-clock runs only: the counters describe threads.
+class MetricsExporter {
+private:
+    Building& building;
+    string path;
+    chrono::milliseconds interval;
+    thread worker;
+    mutex mtx;
+    condition_variable cv;
+    bool stopping = false;
+    size_t depthMax = 0; // over all samples so far; worker thread, then stop()
+
+    string render() {
+        size_t depth = building.waitingCalls();
+        depthMax = max(depthMax, depth);
+        ostringstream out;
+        out << fixed << setprecision(6);
+        auto family = [&](const char* name, const char* type, const char* help) {
+            out << "# HELP " << name << ' ' << help << "\n# TYPE " << name << ' ' << type << '\n';
+        };
+        auto seconds = [](const atomic<uint64_t>& ns) { return ns.load(memory_order_relaxed) / 1e9; };
+
+        // One pass per family keeps each family's samples together, as the format asks
+        auto perLock = [&](const char* name, const char* help, auto value) {
+            family(name, "counter", help);
+            ThreadRegistry::instance().forEach([&](ThreadStats& t) {
+                for (size_t i = 0; i < t.locks.size(); i++) {
+                    if (t.locks[i].acquired.load(memory_order_relaxed) == 0) continue;
+                    out << name << "{thread=\"" << t.name << "\",lock=\"" << lockSiteNames[i] << "\"} "
+                        << value(t.locks[i]) << '\n';
+                }
+            });
+        };
+        perLock("elevator_lock_acquisitions_total", "Mutex acquisitions.",
+                [](auto& l) { return l.acquired.load(memory_order_relaxed); });
+        perLock("elevator_lock_contended_total", "Acquisitions that found the mutex held.",
+                [](auto& l) { return l.contended.load(memory_order_relaxed); });
+        perLock("elevator_lock_wait_seconds_total", "Time blocked acquiring the mutex.",
+                [&](auto& l) { return seconds(l.waitNanos); });
+
+        auto perWait = [&](const char* name, const char* help, auto value) {
+            family(name, "counter", help);
+            ThreadRegistry::instance().forEach([&](ThreadStats& t) {
+                for (size_t i = 0; i < t.waits.size(); i++) {
+                    if (t.waits[i].waits.load(memory_order_relaxed) == 0) continue;
+                    out << name << "{thread=\"" << t.name << "\",site=\"" << waitSiteNames[i] << "\"} "
+                        << value(t.waits[i]) << '\n';
+                }
+            });
+        };
+        perWait("elevator_waits_total", "Times the thread blocked waiting for work.",
+                [](auto& w) { return w.waits.load(memory_order_relaxed); });
+        perWait("elevator_wakeups_total", "Returns from a blocking wait.",
+                [](auto& w) { return w.wakeups.load(memory_order_relaxed); });
+        perWait("elevator_spurious_wakeups_total", "Wakeups that found nothing to do.",
+                [](auto& w) { return w.spurious.load(memory_order_relaxed); });
+        perWait("elevator_wait_seconds_total", "Time blocked waiting for work.",
+                [&](auto& w) { return seconds(w.waitNanos); });
+
+        family("elevator_thread_idle_ratio", "gauge", "Share of the thread's life spent blocked waiting for work.");
+        ThreadRegistry::instance().forEach([&](ThreadStats& t) {
+            uint64_t waited = 0;
+            for (auto& w : t.waits) waited += w.waitNanos.load(memory_order_relaxed);
+            uint64_t alive = ThreadStats::nanosSince(t.born);
+            if (waited) out << "elevator_thread_idle_ratio{thread=\"" << t.name << "\"} " << static_cast<double>(waited) / alive << '\n';
+        });
+        family("elevator_log_stall_seconds_total", "counter", "Time spent waiting for room in a full log ring.");
+        ThreadRegistry::instance().forEach([&](ThreadStats& t) {
+            if (t.logStalls.load(memory_order_relaxed)) {
+                out << "elevator_log_stall_seconds_total{thread=\"" << t.name << "\"} " << seconds(t.logStallNanos) << '\n';
+            }
+        });
+
+        family("elevator_queue_depth", "gauge", "Calls waiting in the building's queues for a car to take them.");
+        out << "elevator_queue_depth " << depth << '\n';
+        family("elevator_queue_depth_max", "gauge", "Largest queue depth sampled so far.");
+        out << "elevator_queue_depth_max " << depthMax << '\n';
+        family("elevator_car_idle_ratio", "gauge", "Share of the run the car spent idle (completed busy periods).");
+        double elapsed = chrono::duration<double>(building.elapsed()).count();
+        for (int i = 0; i < building.elevatorCount(); i++) {
+            double busy = building.elevator(i).stats().busyNanos.load(memory_order_relaxed) / 1e9;
+            out << "elevator_car_idle_ratio{car=\"" << i << "\"} " << (elapsed > 0 ? max(0.0, 1 - busy / elapsed) : 1.0) << '\n';
+        }
+        return out.str();
+    }
+
+    void halt() {
+        {
+            lock_guard<mutex> lk(mtx);
+            stopping = true;
+        }
+        cv.notify_all();
+        if (worker.joinable()) worker.join();
+    }
+
+    void write() {
+        string text = render();
+        string tmp = path + ".tmp";
+        ofstream f(tmp, ios::trunc);
+        f << text;
+        f.close();
+        if (!f || rename(tmp.c_str(), path.c_str()) != 0) throw runtime_error("cannot write metrics to " + path);
+    }
+
+public:
+    MetricsExporter(Building& b, string path, chrono::milliseconds interval)
+        : building(b), path(move(path)), interval(interval) {}
+    ~MetricsExporter() { halt(); }
+
+    void start() {
+        profiling = true;
+        write(); // fail early on an unwritable path
+        worker = thread([this] {
+            ThreadRegistry::instance().nameThread("metrics");
+            unique_lock<mutex> lk(mtx);
+            while (!cv.wait_for(lk, interval, [&] { return stopping; })) {
+                try {
+                    write();
+                }
+                catch (const exception& e) {
+                    cerr << "Error: " << e.what() << endl;
+                }
+            }
+        });
+    }
+
+    // Joins the worker and writes the final figures
+    void stop() {
+        halt();
+        write();
+    }
+};
+
+// Discrete-event driver for virtual time: request arrivals and elevator steps
+// are events on one queue, so a run takes only as long as its computation
+class EventSimulator {
+private:
+    enum class EventKind { RequestArrival, ElevatorStep };
+
+    struct Event {
+        SimTime at;
+        uint64_t seq; // keeps simultaneous events in scheduling order
+        EventKind kind;
+        int elevator;
+
+        bool operator>(const Event& o) const {
+            return at != o.at ? at > o.at : seq > o.seq;
+        }
+    };
+
+    Building& building;
+    VirtualClock& clock;
+    priority_queue<Event, vector<Event>, greater<Event>> events;
+    uint64_t nextSeq = 0;
+    vector<bool> idle;
+    RequestSource& source;
+    optional<Arrival> nextArrival;
+    vector<Request> burst;
+    vector<int> routed;
+    SimTime start;
+    bool started = false;
+    bool awaitingFeed = false;
+
+    void schedule(SimTime at, EventKind kind, int elevator = -1) {
+        events.push({ at, nextSeq++, kind, elevator });
+    }
+
+    void wakeElevator(int i) {
+        if (idle[i]) {
+            idle[i] = false;
+            schedule(clock.now(), EventKind::ElevatorStep, i);
+        }
+    }
+
+    void wakeIdleElevator() {
+        for (int i = 0; i < building.elevatorCount(); i++) {
+            if (idle[i]) {
+                wakeElevator(i);
+                return;
+            }
+        }
+    }
+
+    // Only the next arrival is ever pending, so traces stream through
+    void scheduleNextArrival() {
+        nextArrival = source.next();
+        if (nextArrival) {
+            schedule(start + nextArrival->offset, EventKind::RequestArrival);
+        }
+        else {
+            sourceDry();
+        }
+    }
+
+    void sourceDry() {
+        if (source.feeding()) awaitingFeed = true;
+        else building.stopAcceptingRequests();
+    }
+
+    // Calls due at the same instant are submitted as one batch
+    void onRequestArrival() {
+        SimTime now = clock.now();
+        burst.clear();
+        do {
+            burst.push_back({ nextArrival->sourceFloor, nextArrival->destFloor, now, nextArrival->tag });
+            nextArrival = source.next();
+        } while (nextArrival && start + nextArrival->offset <= now);
+
+        building.addRequests(burst, &routed);
+        for (int car : routed) {
+            if (car >= 0 && (idle[car] || !building.workStealing())) wakeElevator(car);
+            else wakeIdleElevator();
+        }
+        if (nextArrival) schedule(start + nextArrival->offset, EventKind::RequestArrival);
+        else sourceDry();
+    }
+
+    void onElevatorStep(int i) {
+        Elevator& e = building.elevator(i);
+        auto d = e.step();
+        if (!d) {
+            if (auto r = building.tryTakeRequest(i)) {
+                e.accept(*r);
+                d = e.step();
+            }
+        }
+        if (d) {
+            schedule(clock.now() + *d, EventKind::ElevatorStep, i);
+        }
+        else {
+            idle[i] = true;
+        }
+    }
+
+public:
+    EventSimulator(Building& b, VirtualClock& c, RequestSource& src)
+        : building(b), clock(c), idle(b.elevatorCount(), true), source(src), start(c.now()) {
+        building.setEventDriven();
+    }
+
+    // Processes every event due at or before `until`; returns false once the
+    // run is over. Lets a caller interleave many simulations in time slices.
+    bool runUntil(SimTime until) {
+        if (!started) {
+            started = true;
+            scheduleNextArrival();
+        }
+        while (!events.empty() && events.top().at <= until) {
+            Event ev = events.top();
+            events.pop();
+            clock.advanceTo(ev.at);
+            if (ev.kind == EventKind::RequestArrival) onRequestArrival();
+            else onElevatorStep(ev.elevator);
+        }
+        return !events.empty();
+    }
+
+    void run() { runUntil(SimTime::max()); }
+
+    // Everything needed to carry on from the current instant: clock, pending
+    // events, the next arrival and the source's position (not the building)
+    void save(SnapshotWriter& w) const {
+        w.put(clock.now());
+        w.put(start);
+        w.put(started);
+        w.put(awaitingFeed);
+        w.put(nextSeq);
+        auto pendingEvents = events;
+        w.put<uint64_t>(pendingEvents.size());
+        for (; !pendingEvents.empty(); pendingEvents.pop()) w.put(pendingEvents.top());
+        w.put<uint64_t>(idle.size());
+        for (bool v : idle) w.put(v);
+        w.put(nextArrival.has_value());
+        if (nextArrival) w.put(*nextArrival);
+        source.save(w);
+    }
+
+    // Into a simulator that has not run yet
+    void restore(SnapshotReader& r) {
+        clock.advanceTo(r.get<SimTime>());
+        start = r.get<SimTime>();
+        started = r.get<bool>();
+        awaitingFeed = r.get<bool>();
+        nextSeq = r.get<uint64_t>();
+        vector<Event> pendingEvents;
+        r.getAll<Event>(pendingEvents);
+        events = {};
+        for (const Event& ev : pendingEvents) {
+            if (ev.kind == EventKind::ElevatorStep && (ev.elevator < 0 || ev.elevator >= building.elevatorCount())) {
+                throw runtime_error("snapshot has an event for a missing car");
+            }
+            events.push(ev);
+        }
+        if (r.get<uint64_t>() != idle.size()) throw runtime_error("snapshot has the wrong fleet size");
+        for (size_t i = 0; i < idle.size(); i++) idle[i] = r.get<bool>();
+        nextArrival.reset();
+        if (r.get<bool>()) {
+            nextArrival = r.get<Arrival>();
+            checkSnapshotCall(nextArrival->sourceFloor, nextArrival->destFloor, building.floors());
+        }
+        source.restore(r);
+    }
+
+    // Picks up what an open source was fed since it last came up empty
+    void resumeArrivals() {
+        if (!awaitingFeed) return;
+        awaitingFeed = false;
+        scheduleNextArrival();
+    }
+};
+
+// One bank of a zoned tower: it serves up to highFloor, from the top of the
+// zone below (its sky lobby) or from floor 1 for the lowest zone
+struct ZoneSpec {
+    int highFloor;
+    int elevators;
+};
+
+// Everything main can set from the command line
+struct SimConfig {
+    int elevators = 2;
+    int floors = 10;
+    long long requests = 10;
+    bool virtualTime = false;
+    DispatchMode dispatch = DispatchMode::Fifo;
+    QueueMode queue = QueueMode::Shared;
+    CarSpec car;
+    LogLevel logLevel = LogLevel::Trace;
+    uint32_t logSample = 1;
+    string tracePath;
+    TrafficConfig traffic;
+    uint64_t seed = static_cast<uint64_t>(time(nullptr));
+    ExecutionMode exec = ExecutionMode::Threads; // wall-clock mode only
+    int buildings = 1; // more than one runs a CampusEngine (virtual time only)
+    int workers = static_cast<int>(max(1u, thread::hardware_concurrency()));
+    chrono::milliseconds drainDeadline{ 0 }; // wall clock; 0 serves every queued call
+    string serveEndpoint; // take calls from the control socket instead of a source
+    string controlBind = "127.0.0.1"; // IPv4 address a tcp: endpoint listens on
+    string metricsPath;   // wall clock: Prometheus text dump of the contention counters
+    chrono::milliseconds metricsInterval{ 1000 };
+    vector<ZoneSpec> zones; // non-empty runs a ZonedTower (virtual time only)
+    SimDuration transferTime = chrono::seconds(20); // sky-lobby walk between zones
+    SimDuration prepositionBucket{ 0 }; // demand bucket for parking idle cars, 0 for off
+    SimDuration prepositionPeriod = chrono::hours(24);
+    double fleetTargetP95Ms = 0; // above 0 sizes the fleet instead of running once (virtual time only)
+    int fleetMin = 1, fleetMax = 0; // car counts to try; fleetMax 0 for up to elevators
+    int fleetTrials = 200;          // seeded trials per car count and profile
+    vector<TrafficProfile> fleetProfiles; // empty for traffic.profile alone
+    string eventLogPath;   // columnar binary log of calls, floors passed, pick-ups and drop-offs
+    string readEventsPath; // summarize an event log instead of running
+    string snapshotPath;  // checkpoint the virtual run here...
+    SimDuration snapshotAt{}; // ...once simulated time reaches this
+    string restorePath;   // resume a virtual run from this checkpoint
+    uint64_t forkSeed = 0; // reseed synthetic traffic after restoring; 0 keeps the saved stream
+};
+
+// Applies the per-building settings; call before the run starts
+void configureBuilding(Building& b, const SimConfig& cfg) {
+    b.setCarSpec(cfg.car);
+    if (cfg.prepositionBucket > SimDuration::zero()) b.enablePrepositioning(cfg.prepositionBucket, cfg.prepositionPeriod);
+}
+
+// Checkpoint file layout: this header, the simulator's state, then the building's
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    int32_t elevators;
+    int32_t floors;
+    int32_t dispatch;
+    int32_t queue;
+    // The CarSpec, since a car restored mid-dwell or mid-run is only valid under it
+    int32_t capacity;
+    int64_t boardNanos;
+    int64_t alightNanos;
+    int64_t doorOpenNanos;
+    int64_t doorCloseNanos;
+    double floorHeight;
+    double maxSpeed;
+    double acceleration;
+    double jerk;
+};
+
+constexpr char snapshotMagic[8] = { 'E', 'L', 'E', 'V', 'S', 'N', 'A', 'P' };
+constexpr uint32_t snapshotVersion = 6;
+
+SnapshotHeader snapshotHeaderFor(const Building& b) {
+    SnapshotHeader h{};
+    memcpy(h.magic, snapshotMagic, sizeof h.magic);
+    h.version = snapshotVersion;
+    h.elevators = b.elevatorCount();
+    h.floors = b.floors();
+    h.dispatch = static_cast<int32_t>(b.dispatchMode());
+    h.queue = static_cast<int32_t>(b.queueingMode());
+    const CarSpec& car = b.carSpec();
+    h.capacity = car.capacity;
+    h.boardNanos = car.boardTime.count();
+    h.alightNanos = car.alightTime.count();
+    h.doorOpenNanos = car.doorOpenTime.count();
+    h.doorCloseNanos = car.doorCloseTime.count();
+    h.floorHeight = car.floorHeight;
+    h.maxSpeed = car.maxSpeed;
+    h.acceleration = car.acceleration;
+    h.jerk = car.jerk;
+    return h;
+}
+
+// Written beside the target and renamed over it, so a crash never leaves a torn snapshot
+size_t saveSnapshot(const string& path, const EventSimulator& sim, Building& b) {
+    SnapshotWriter w;
+    w.put(snapshotHeaderFor(b));
+    sim.save(w);
+    b.save(w);
+    string tmp = path + ".tmp";
+    {
+        ofstream out(tmp, ios::binary | ios::trunc);
+        out.write(reinterpret_cast<const char*>(w.data().data()), static_cast<streamsize>(w.data().size()));
+        if (!out.flush()) throw runtime_error("cannot write snapshot " + tmp);
+    }
+    if (rename(tmp.c_str(), path.c_str()) != 0) throw runtime_error("cannot rename snapshot to " + path);
+    return w.data().size();
+}
+
+// Maps the file and decodes it in place into a simulator and building that
+// have not run yet and were built with the same cars, floors and modes
+void restoreSnapshot(const string& path, EventSimulator& sim, Building& b) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw runtime_error("cannot open snapshot " + path);
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        throw runtime_error("cannot read snapshot " + path);
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    void* m = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) throw runtime_error("cannot map snapshot " + path);
+    madvise(m, size, MADV_SEQUENTIAL);
+    try {
+        SnapshotReader r(m, size);
+        SnapshotHeader h = r.get<SnapshotHeader>();
+        SnapshotHeader want = snapshotHeaderFor(b);
+        if (memcmp(h.magic, snapshotMagic, sizeof h.magic) != 0 || h.version != snapshotVersion) {
+            throw runtime_error(path + " is not a snapshot from this version");
+        }
+        if (h.elevators != want.elevators || h.floors != want.floors || h.dispatch != want.dispatch ||
+            h.queue != want.queue) {
+            throw runtime_error(path + " needs --elevators " + to_string(h.elevators) + " --floors " +
+                                to_string(h.floors) + " and the dispatch and queue modes it was taken with");
+        }
+        if (h.capacity != want.capacity || h.boardNanos != want.boardNanos || h.alightNanos != want.alightNanos ||
+            h.doorOpenNanos != want.doorOpenNanos || h.doorCloseNanos != want.doorCloseNanos ||
+            h.floorHeight != want.floorHeight || h.maxSpeed != want.maxSpeed || h.acceleration != want.acceleration ||
+            h.jerk != want.jerk) {
+            throw runtime_error(path + " differs in --capacity, the dwell times, --motion or --floor-height");
+        }
+        sim.restore(r);
+        b.restore(r);
+        if (!r.atEnd()) throw runtime_error(path + " has trailing data");
+    }
+    catch (...) {
+        munmap(m, size);
+        throw;
+    }
+    munmap(m, size);
+}
+
+// Runs one virtual-time simulation over source and returns its report,
+// optionally resuming from a snapshot and/or writing one part way through
+RunReport runVirtual(const SimConfig& cfg, RequestSource& source) {
+    VirtualClock clock;
+    Building b(cfg.elevators, cfg.floors, clock, cfg.dispatch, cfg.queue);
+    configureBuilding(b, cfg);
+    EventSimulator sim(b, clock, source);
+    if (!cfg.restorePath.empty()) {
+        restoreSnapshot(cfg.restorePath, sim, b);
+        if (cfg.forkSeed) {
+            auto* synthetic = dynamic_cast<SyntheticSource*>(&source);
+            if (!synthetic) throw invalid_argument("--fork-seed needs synthetic traffic");
+            synthetic->reseed(cfg.forkSeed);
+        }
+    }
+    if (!cfg.snapshotPath.empty()) {
+        sim.runUntil(SimTime{} + cfg.snapshotAt);
+        size_t bytes = saveSnapshot(cfg.snapshotPath, sim, b);
+        cout << "Snapshot at " << chrono::duration<double>(clock.now().time_since_epoch()).count() << " s: "
+             << cfg.snapshotPath << " (" << bytes << " bytes)" << endl;
+    }
+    sim.run();
+    return b.report();
+}
+
+// End-of-run figures for a campus of independent buildings
+struct CampusReport {
+    int buildings = 0;
+    int workers = 0;
+    double wallSeconds = 0;
+    double meanUtilization = 0; // over every car in every building
+    RunReport run; // latencies merged over all buildings; simSeconds is the longest run
+};
+
+// Runs many independent buildings in virtual time on a fixed pool of worker
+// threads. Simulated time advances in epochs: within an epoch workers claim
+// buildings from a shared index and run each up to the epoch's end, and a
+// barrier separates epochs so no building runs far ahead of the rest.
+// Finished buildings fold their statistics into per-worker totals and are
+// freed straight away, which keeps memory flat for large campuses.
+class CampusEngine {
+private:
+    struct Site {
+        VirtualClock clock;
+        SyntheticSource source;
+        Building building;
+        EventSimulator sim;
+
+        Site(const SimConfig& cfg, uint64_t stream)
+            : source(cfg.traffic, cfg.requests, cfg.floors, cfg.seed, stream),
+              building(cfg.elevators, cfg.floors, clock, cfg.dispatch, cfg.queue),
+              sim(building, clock, source) {
+            configureBuilding(building, cfg);
+        }
+    };
+
+    // Written only by its own worker; padded so workers don't share lines
+    struct alignas(64) WorkerTotals {
+        LatencyHistogram wait, ride;
+        double simSeconds = 0;
+        double utilizationSum = 0;
+        long long cars = 0;
+        uint64_t stops = 0, fullStops = 0;
+        int peakLoad = 0;
+        double energyKwh = 0;
+    };
+
+    vector<unique_ptr<Site>> sites;
+    vector<size_t> active; // sites still running, rebuilt between epochs
+    vector<unique_ptr<WorkerTotals>> totals;
+    SimDuration epoch;
+    SimTime epochEnd;
+    atomic<size_t> nextSite{ 0 };
+    bool done = false;
+    int capacity; // every building shares the CarSpec
+
+    void retire(size_t i, WorkerTotals& t) {
+        Building& b = sites[i]->building;
+        b.mergeStats(t.wait, t.ride);
+        RunReport r = b.report();
+        t.simSeconds = max(t.simSeconds, r.simSeconds);
+        for (double u : r.utilization) t.utilizationSum += u;
+        t.cars += static_cast<long long>(r.utilization.size());
+        t.stops += r.stops;
+        t.fullStops += r.fullStops;
+        t.peakLoad = max(t.peakLoad, r.peakLoad);
+        t.energyKwh += r.energyKwh;
+        sites[i].reset();
+    }
+
+    // Runs between epochs, once every worker has arrived at the barrier
+    void endEpoch() noexcept {
+        erase_if(active, [&](size_t i) { return !sites[i]; });
+        nextSite.store(0, memory_order_relaxed);
+        epochEnd += epoch;
+        done = active.empty();
+    }
+
+public:
+    CampusEngine(const SimConfig& cfg, int buildings, SimDuration epochLength = chrono::seconds(60))
+        : epoch(epochLength), epochEnd(SimTime{} + epochLength), capacity(cfg.car.capacity) {
+        sites.reserve(buildings);
+        for (int i = 0; i < buildings; i++) {
+            sites.push_back(make_unique<Site>(cfg, static_cast<uint64_t>(i)));
+            active.push_back(static_cast<size_t>(i));
+        }
+    }
+
+    CampusReport run(int workers) {
+        workers = max(1, min(workers, static_cast<int>(sites.size())));
+        totals.clear();
+        for (int w = 0; w < workers; w++) totals.push_back(make_unique<WorkerTotals>());
+        done = active.empty();
+
+        auto wallStart = chrono::steady_clock::now();
+        uint64_t allocationsAtStart = heapAllocations.load(memory_order_relaxed);
+        auto completion = [this]() noexcept { endEpoch(); };
+        barrier<decltype(completion)> sync(workers, completion);
+        vector<thread> pool;
+        for (int w = 0; w < workers; w++) {
+            pool.emplace_back([&, w] {
+                WorkerTotals& t = *totals[w];
+                while (!done) {
+                    for (size_t k; (k = nextSite.fetch_add(1, memory_order_relaxed)) < active.size();) {
+                        size_t i = active[k];
+                        if (!sites[i]->sim.runUntil(epochEnd)) retire(i, t);
+                    }
+                    sync.arrive_and_wait();
+                }
+            });
+        }
+        for (auto& t : pool) t.join();
+
+        LatencyHistogram wait, ride;
+        CampusReport c;
+        c.buildings = static_cast<int>(sites.size());
+        c.workers = workers;
+        c.wallSeconds = chrono::duration<double>(chrono::steady_clock::now() - wallStart).count();
+        double utilizationSum = 0;
+        long long cars = 0;
+        for (auto& t : totals) {
+            wait.mergeFrom(t->wait);
+            ride.mergeFrom(t->ride);
+            c.run.simSeconds = max(c.run.simSeconds, t->simSeconds);
+            utilizationSum += t->utilizationSum;
+            cars += t->cars;
+            c.run.stops += t->stops;
+            c.run.fullStops += t->fullStops;
+            c.run.peakLoad = max(c.run.peakLoad, t->peakLoad);
+            c.run.energyKwh += t->energyKwh;
+        }
+        c.run.capacity = capacity;
+        c.run.allocations = heapAllocations.load(memory_order_relaxed) - allocationsAtStart;
+        c.run.served = ride.count();
+        c.run.wait = summarize(wait);
+        c.run.ride = summarize(ride);
+        c.meanUtilization = cars ? utilizationSum / cars : 0;
+        return c;
+    }
+};
+
+void printCampusReport(const CampusReport& c) {
+    cout << "Campus: " << c.buildings << " buildings on " << c.workers << " worker threads, "
+         << fixed << setprecision(2) << c.wallSeconds << " s wall";
+    if (c.wallSeconds > 0) cout << " (" << setprecision(0) << c.run.served / c.wallSeconds << " simulated req/s)";
+    cout << endl;
+    cout.unsetf(ios::floatfield);
+    printReport(c.run);
+    if (c.run.served > 0) {
+        cout << fixed << setprecision(1) << "Mean utilization: " << 100 * c.meanUtilization << "%" << endl;
+        cout.unsetf(ios::floatfield);
+    }
+}
+
+// Arrivals the tower hands one zone, released only below a horizon so the
+// zone never sees a call from before its own clock
+class ZoneFeed : public RequestSource {
+private:
+    struct Later {
+        bool operator()(const Arrival& a, const Arrival& b) const { return a.offset > b.offset; }
+    };
+
+    priority_queue<Arrival, vector<Arrival>, Later> queued;
+    SimDuration horizon{ 0 };
+    bool closed = false;
+
+public:
+    void push(const Arrival& a) { queued.push(a); }
+    void releaseBefore(SimDuration h) { horizon = h; }
+    void close() { closed = true; }
+
+    optional<Arrival> next() override {
+        if (queued.empty() || queued.top().offset >= horizon) return nullopt;
+        Arrival a = queued.top();
+        queued.pop();
+        return a;
+    }
+
+    bool feeding() const override { return !closed; }
+};
+
+struct TowerReport {
+    double wallSeconds = 0;
+    uint64_t journeys = 0;
+    uint64_t transfers = 0; // legs started at a sky lobby
+    LatencySummary journey; // call to final drop-off, transfers included
+    vector<ZoneSpec> zones;
+    vector<RunReport> zoneRuns;
+};
+
+// A tall building split into zones stacked bottom-up. Each zone serves its own
+// floor range with its own cars, queue and dispatcher, and neighbouring zones
+// share a sky lobby: the lower zone's top floor. A trip that crosses zones
+// rides to the lobby, spends transferTime walking across and calls again in
+// the next zone. Zones run in parallel, one thread each, in epochs of
+// transferTime: a leg started by a drop-off in one epoch is never due before
+// the next, so swapping transfers at the barrier keeps every zone's timeline exact.
+class ZonedTower {
+private:
+    struct Transfer {
+        uint32_t tag;
+        int floor; // tower floor
+        SimTime at;
+    };
+
+    struct Zone {
+        int lowFloor;
+        int highFloor;
+        VirtualClock clock;
+        ZoneFeed feed;
+        Building building;
+        EventSimulator sim;
+        vector<Transfer> arrived; // drop-offs this epoch; the zone's thread only
+
+        Zone(const SimConfig& cfg, int low, int high, int cars)
+            : lowFloor(low), highFloor(high), building(cars, high - low + 1, clock, cfg.dispatch, cfg.queue),
+              sim(building, clock, feed) {
+            configureBuilding(building, cfg);
+            building.onDropOff([this](const Request& r, SimTime at) {
+                arrived.push_back({ r.tag, r.destFloor + lowFloor - 1, at });
+            });
+        }
+    };
+
+    struct Journey {
+        SimDuration calledAt;
+        int destFloor;
+    };
+
+    vector<ZoneSpec> specs;
+    vector<unique_ptr<Zone>> zones;
+    RequestSource& source;
+    optional<Arrival> upcoming;
+    vector<Journey> journeys; // tag - 1
+    uint64_t openJourneys = 0;
+    uint64_t transfers = 0;
+    LatencyHistogram journeyTimes;
+    SimDuration transferTime;
+    SimTime epochEnd;
+    bool done = false;
+
+    // The zone a leg leaving `from` rides in: upward legs take the zone whose
+    // lobby or interior floor `from` is, downward ones the zone above it
+    Zone& zoneFor(int from, int dest) {
+        for (auto& z : zones) {
+            if (dest > from ? from >= z->lowFloor && from < z->highFloor : from > z->lowFloor && from <= z->highFloor) {
+                return *z;
+            }
+        }
+        throw logic_error("no zone serves floor " + to_string(from));
+    }
+
+    void sendLeg(uint32_t tag, int from, SimDuration at) {
+        int dest = journeys[tag - 1].destFloor;
+        Zone& z = zoneFor(from, dest);
+        int to = dest > from ? min(dest, z.highFloor) : max(dest, z.lowFloor);
+        z.feed.push({ at, from - z.lowFloor + 1, to - z.lowFloor + 1, tag });
+    }
+
+    void admitBefore(SimTime limit) {
+        while (upcoming && SimTime{} + upcoming->offset < limit) {
+            journeys.push_back({ upcoming->offset, upcoming->destFloor });
+            openJourneys++;
+            sendLeg(static_cast<uint32_t>(journeys.size()), upcoming->sourceFloor, upcoming->offset);
+            upcoming = source.next();
+        }
+    }
+
+    // Runs between epochs, once every zone has arrived at the barrier
+    void endEpoch() noexcept {
+        for (auto& z : zones) {
+            for (const Transfer& t : z->arrived) {
+                const Journey& j = journeys[t.tag - 1];
+                if (t.floor == j.destFloor) {
+                    journeyTimes.record(t.at - (SimTime{} + j.calledAt));
+                    openJourneys--;
+                }
+                else {
+                    transfers++;
+                    sendLeg(t.tag, t.floor, t.at.time_since_epoch() + transferTime);
+                }
+            }
+            z->arrived.clear();
+        }
+        epochEnd += transferTime;
+        openEpoch();
+    }
+
+    void openEpoch() {
+        admitBefore(epochEnd);
+        done = !upcoming && openJourneys == 0;
+        for (auto& z : zones) {
+            z->feed.releaseBefore(epochEnd.time_since_epoch());
+            if (done) z->feed.close();
+            z->sim.resumeArrivals();
+        }
+    }
+
+public:
+    ZonedTower(const SimConfig& cfg, RequestSource& src)
+        : specs(cfg.zones), source(src), transferTime(cfg.transferTime), epochEnd(SimTime{} + cfg.transferTime) {
+        int low = 1;
+        for (const ZoneSpec& z : specs) {
+            zones.push_back(make_unique<Zone>(cfg, low, z.highFloor, z.elevators));
+            low = z.highFloor;
+        }
+    }
+
+    TowerReport run() {
+        auto wallStart = chrono::steady_clock::now();
+        upcoming = source.next();
+        openEpoch();
+
+        auto completion = [this]() noexcept { endEpoch(); };
+        barrier<decltype(completion)> sync(static_cast<ptrdiff_t>(zones.size()), completion);
+        vector<thread> pool;
+        for (auto& z : zones) {
+            pool.emplace_back([&, zone = z.get()] {
+                while (!done) {
+                    zone->sim.runUntil(epochEnd - SimDuration(1)); // epochs are half-open
+                    sync.arrive_and_wait();
+                }
+            });
+        }
+        for (auto& t : pool) t.join();
+
+        TowerReport r;
+        r.wallSeconds = chrono::duration<double>(chrono::steady_clock::now() - wallStart).count();
+        r.journeys = journeyTimes.count();
+        r.transfers = transfers;
+        r.journey = summarize(journeyTimes);
+        r.zones = specs;
+        for (auto& z : zones) r.zoneRuns.push_back(z->building.report());
+        return r;
+    }
 };
 
-// Elevator class declaration
-class Elevator {
+void printTowerReport(const TowerReport& t) {
+    cout << "Tower: " << t.zones.size() << " zones, " << t.journeys << " journeys with " << t.transfers
+         << " sky-lobby transfers, " << fixed << setprecision(2) << t.wallSeconds << " s wall" << endl
+         << setprecision(1) << "  (ms)        mean        p50        p90        p99        max" << endl
+         << "  journey";
+    for (double v : { t.journey.meanMs, t.journey.p50Ms, t.journey.p90Ms, t.journey.p99Ms, t.journey.maxMs }) {
+        cout << ' ' << setw(10) << v;
+    }
+    cout << endl;
+    cout.unsetf(ios::floatfield);
+    int low = 1;
+    for (size_t i = 0; i < t.zones.size(); i++) {
+        cout << "Zone " << i + 1 << ": floors " << low << "-" << t.zones[i].highFloor << ", "
+             << t.zones[i].elevators << " cars" << endl;
+        printReport(t.zoneRuns[i]);
+        low = t.zones[i].highFloor;
+    }
+}
+
+// Runs tasks 0..n-1 on a fixed set of threads. Each worker starts with a
+// contiguous block of indices in its own deque and takes from the back; once
+// that is empty it steals from the front of the others', so a block of slow
+// tasks is spread out instead of holding up the whole run. Nothing is added
+// after the start, so a worker that finds every deque empty is done.
+class TrialPool {
 private:
-    int id;
-    int currentFloor = 1;
-    thread thr;
-    Building* building;
-    bool running = true;
+    struct alignas(64) Queue {
+        mutex mtx;
+        deque<size_t> tasks;
+    };
 
-    static mutex logMtx;
+    vector<unique_ptr<Queue>> queues;
 
-    void log(const string& msg);
-    void moveTo(int target);
-    void process(const Request& r);
-    void run();
+    optional<size_t> popOwn(Queue& q) {
+        lock_guard<mutex> lk(q.mtx);
+        if (q.tasks.empty()) return nullopt;
+        size_t t = q.tasks.back();
+        q.tasks.pop_back();
+        return t;
+    }
+
+    optional<size_t> steal(size_t thief) {
+        for (size_t k = 1; k < queues.size(); k++) {
+            Queue& q = *queues[(thief + k) % queues.size()];
+            lock_guard<mutex> lk(q.mtx);
+            if (q.tasks.empty()) continue;
+            size_t t = q.tasks.front();
+            q.tasks.pop_front();
+            return t;
+        }
+        return nullopt;
+    }
 
 public:
-    Elevator(int id, Building* b);
-    ~Elevator(); // ensure proper cleanup
-    void start();
-    void stop();
+    // fn runs on the workers and must only touch state owned by its task;
+    // the first exception stops the remaining tasks and is rethrown here
+    template <typename Fn>
+    void run(size_t n, int workers, Fn&& fn) {
+        workers = max(1, min(workers, static_cast<int>(max<size_t>(n, 1))));
+        queues.clear();
+        for (int w = 0; w < workers; w++) {
+            queues.push_back(make_unique<Queue>());
+            for (size_t t = n * w / workers; t < n * (w + 1) / workers; t++) queues.back()->tasks.push_back(t);
+        }
+        atomic<bool> failed{ false };
+        exception_ptr error;
+        mutex errorMtx;
+        vector<thread> pool;
+        for (int w = 0; w < workers; w++) {
+            pool.emplace_back([&, w] {
+                ThreadRegistry::instance().nameThread("trial " + to_string(w));
+                while (!failed.load(memory_order_relaxed)) {
+                    optional<size_t> t = popOwn(*queues[w]);
+                    if (!t) t = steal(static_cast<size_t>(w));
+                    if (!t) return;
+                    try {
+                        fn(*t);
+                    }
+                    catch (...) {
+                        lock_guard<mutex> lk(errorMtx);
+                        if (!error) error = current_exception();
+                        failed.store(true, memory_order_relaxed);
+                    }
+                }
+            });
+        }
+        for (auto& t : pool) t.join();
+        if (error) rethrow_exception(error);
+    }
 };
 
-mutex Elevator::logMtx;
+// One car count under one traffic profile, over every trial
+struct FleetCandidate {
+    int cars = 0;
+    double meanP95Ms = 0;
+    double halfWidthMs = 0; // of the 95% confidence interval on meanP95Ms
+    double passRate = 0;    // trials whose own p95 met the target
+};
 
-// Building class definition
-class Building {
+struct FleetProfileResult {
+    TrafficProfile profile = TrafficProfile::Uniform;
+    vector<FleetCandidate> candidates; // by car count, smallest first
+    int minimumCars = 0; // smallest count whose interval lies under the target, 0 if none
+};
+
+struct FleetSizingReport {
+    double targetP95Ms = 0;
+    int trials = 0; // per car count and profile
+    int workers = 0;
+    double wallSeconds = 0;
+    vector<FleetProfileResult> profiles;
+};
+
+// Monte Carlo fleet sizing: for every profile and car count, runs the same
+// seeded trials in virtual time and compares the mean per-trial p95 wait
+// against the target. Trial k uses seed + k at every car count and profile
+// (common random numbers), so differences between fleet sizes come from the
+// cars rather than from the draw. Each trial builds its own source, clock
+// and building and writes a single slot of a preallocated result array, so
+// trials share no mutable state and the report does not depend on --workers.
+class FleetSizer {
 private:
-    vector<shared_ptr<Elevator>> elevators;
-    queue<Request> requestQ;
-    mutex mtx;
-    condition_variable cv;
-    bool acceptingRequests = true;
-    int numFloors;
+    SimConfig base;
+    vector<TrafficProfile> profiles;
+    int minCars, maxCars;
 
-public:
-    Building(int numElev, int floors) : numFloors(floors) {
-        for (int i = 0; i < numElev; i++) {
-            elevators.push_back(make_shared<Elevator>(i, this));
+    double trialP95Ms(TrafficProfile profile, int cars, int trial) const {
+        SimConfig cfg = base;
+        cfg.elevators = cars;
+        cfg.traffic.profile = profile;
+        SyntheticSource source(cfg.traffic, cfg.requests, cfg.floors, cfg.seed + static_cast<uint64_t>(trial));
+        return runVirtual(cfg, source).wait.p95Ms;
+    }
+
+    FleetCandidate summarizeTrials(int cars, const double* p95, int n) const {
+        FleetCandidate c;
+        c.cars = cars;
+        double sum = 0;
+        int passed = 0;
+        for (int k = 0; k < n; k++) {
+            sum += p95[k];
+            if (p95[k] <= base.fleetTargetP95Ms) passed++;
         }
+        c.meanP95Ms = sum / n;
+        double squares = 0;
+        for (int k = 0; k < n; k++) squares += (p95[k] - c.meanP95Ms) * (p95[k] - c.meanP95Ms);
+        c.halfWidthMs = n > 1 ? 1.96 * sqrt(squares / (n - 1) / n) : 0;
+        c.passRate = static_cast<double>(passed) / n;
+        return c;
     }
 
-    void startElevators() {
-        for (auto& e : elevators) {
-            e->start();
+public:
+    explicit FleetSizer(const SimConfig& cfg)
+        : base(cfg), profiles(cfg.fleetProfiles), minCars(cfg.fleetMin),
+          maxCars(cfg.fleetMax ? cfg.fleetMax : cfg.elevators) {
+        if (profiles.empty()) profiles.push_back(cfg.traffic.profile);
+        if (minCars > maxCars) throw invalid_argument("--fleet-range needs MIN <= MAX");
+    }
+
+    FleetSizingReport run(int workers) {
+        int counts = maxCars - minCars + 1;
+        int trials = base.fleetTrials;
+        size_t tasks = profiles.size() * counts * trials;
+        vector<double> p95(tasks); // [profile][car count][trial]
+
+        auto wallStart = chrono::steady_clock::now();
+        TrialPool pool;
+        pool.run(tasks, workers, [&](size_t t) {
+            int trial = static_cast<int>(t % trials);
+            int cars = minCars + static_cast<int>(t / trials % counts);
+            p95[t] = trialP95Ms(profiles[t / trials / counts], cars, trial);
+        });
+
+        FleetSizingReport r;
+        r.targetP95Ms = base.fleetTargetP95Ms;
+        r.trials = trials;
+        r.workers = max(1, min(workers, static_cast<int>(tasks)));
+        r.wallSeconds = chrono::duration<double>(chrono::steady_clock::now() - wallStart).count();
+        for (size_t p = 0; p < profiles.size(); p++) {
+            FleetProfileResult& pr = r.profiles.emplace_back();
+            pr.profile = profiles[p];
+            for (int c = 0; c < counts; c++) {
+                FleetCandidate fc = summarizeTrials(minCars + c, &p95[(p * counts + c) * trials], trials);
+                if (!pr.minimumCars && fc.meanP95Ms + fc.halfWidthMs <= r.targetP95Ms) pr.minimumCars = fc.cars;
+                pr.candidates.push_back(fc);
+            }
         }
+        return r;
     }
+};
 
-    void waitForElevators() {
-        for (auto& e : elevators) {
-            e->stop();
+const char* profileName(TrafficProfile p) {
+    return p == TrafficProfile::UpPeak ? "uppeak" : p == TrafficProfile::DownPeak ? "downpeak" : "uniform";
+}
+
+void printFleetSizingReport(const FleetSizingReport& r) {
+    cout << "Fleet sizing: " << r.trials << " trials per size on " << r.workers << " worker threads, " << fixed
+         << setprecision(2) << r.wallSeconds << " s wall; target p95 wait " << setprecision(1)
+         << r.targetP95Ms / 1000 << " s" << endl;
+    for (const FleetProfileResult& pr : r.profiles) {
+        cout << "Profile " << profileName(pr.profile) << ":" << endl
+             << "  cars  p95 wait (s)         95% CI (s)     met" << endl;
+        for (const FleetCandidate& c : pr.candidates) {
+            cout << setw(6) << c.cars << setw(14) << c.meanP95Ms / 1000 << setw(11)
+                 << (c.meanP95Ms - c.halfWidthMs) / 1000 << " - " << left << setw(9)
+                 << (c.meanP95Ms + c.halfWidthMs) / 1000 << right << setw(5) << 100 * c.passRate << "%" << endl;
         }
+        if (pr.minimumCars) cout << "  Minimum fleet: " << pr.minimumCars << " cars" << endl;
+        else cout << "  Minimum fleet: none of the sizes tried meets the target" << endl;
     }
+    cout.unsetf(ios::floatfield);
+}
 
-    void addRequest(const Request& r) {
-        {
-            lock_guard<mutex> lk(mtx);
-            requestQ.push(r);
+// --read-events: counts the events in a log and rebuilds the wait and ride
+// latencies by joining each call's events on its request id, which the
+// building hands out densely so the join is a pair of arrays
+void printEventLogSummary(const string& path) {
+    auto wallStart = chrono::steady_clock::now();
+    EventLogReader log(path);
+    EventLogReader::Columns c;
+    uint64_t counts[4] = {};
+    int64_t first = INT64_MAX, last = INT64_MIN;
+    vector<int64_t> calledAt, pickedUpAt; // by request id, INT64_MIN for not seen yet
+    vector<pair<uint32_t, int64_t>> early; // drop-offs read before their pick-up
+    LatencyHistogram wait, ride;
+    auto slot = [](vector<int64_t>& v, uint32_t id) -> int64_t& {
+        if (id >= v.size()) v.resize(max<size_t>(id + 1, 2 * v.size()), INT64_MIN);
+        return v[id];
+    };
+    for (size_t i = 0; i < log.chunks(); i++) {
+        log.read(i, c);
+        for (size_t k = 0; k < c.size(); k++) {
+            int64_t t = c.timeNanos[k];
+            first = min(first, t);
+            last = max(last, t);
+            counts[static_cast<int>(c.event[k])]++;
+            switch (c.event[k]) {
+            case CarEvent::Call: slot(calledAt, c.request[k]) = t; break;
+            case CarEvent::PickUp: slot(pickedUpAt, c.request[k]) = t; break;
+            case CarEvent::DropOff: {
+                int64_t boarded = slot(pickedUpAt, c.request[k]);
+                if (boarded == INT64_MIN) early.push_back({ c.request[k], t });
+                else ride.record(chrono::nanoseconds(t - boarded));
+                break;
+            }
+            default: break;
+            }
         }
-        cv.notify_one();
     }
+    for (auto [id, t] : early) {
+        int64_t boarded = slot(pickedUpAt, id);
+        if (boarded != INT64_MIN) ride.record(chrono::nanoseconds(t - boarded));
+    }
+    for (size_t id = 0; id < min(calledAt.size(), pickedUpAt.size()); id++) {
+        if (calledAt[id] != INT64_MIN && pickedUpAt[id] != INT64_MIN) {
+            wait.record(chrono::nanoseconds(pickedUpAt[id] - calledAt[id]));
+        }
+    }
+    double wallSeconds = chrono::duration<double>(chrono::steady_clock::now() - wallStart).count();
 
-    void stopAcceptingRequests() {
-        {
-            lock_guard<mutex> lk(mtx);
-            acceptingRequests = false;
+    cout << "Event log: " << log.events() << " events in " << log.chunks() << " chunks, " << fixed
+         << setprecision(2) << static_cast<double>(log.fileBytes()) / log.events() << " bytes per event, read in "
+         << wallSeconds << " s" << endl;
+    if (log.events() == 0) return;
+    cout << setprecision(1) << "Span: " << (last - first) / 1e9 << " s;";
+    for (int e = 0; e < 4; e++) cout << (e ? ", " : " ") << carEventNames[e] << " " << counts[e];
+    cout << endl;
+    LatencySummary w = summarize(wait), r = summarize(ride);
+    cout << "  (ms)        mean        p50        p90        p99        max" << endl;
+    for (auto [name, l] : { pair<const char*, const LatencySummary*>{ "wait", &w }, { "ride", &r } }) {
+        cout << "  " << name;
+        for (double v : { l->meanMs, l->p50Ms, l->p90Ms, l->p99Ms, l->maxMs }) {
+            cout << ' ' << setw(10) << v;
         }
-        cv.notify_all();
+        cout << endl;
     }
+    cout.unsetf(ios::floatfield);
+}
 
-    optional<Request> waitForRequest() {
-        unique_lock<mutex> lk(mtx);
-        cv.wait(lk, [&] { return !requestQ.empty() || !acceptingRequests; });
+#ifdef __linux__
+// Control plane: building controllers send hall calls over a Unix or TCP
+// stream socket and get back the car each was routed to. Records are 8 bytes
+// in host order and are decoded straight out of the receive buffer.
+struct WireCall {
+    uint32_t id; // caller's tag, echoed in the reply
+    uint16_t sourceFloor;
+    uint16_t destFloor;
+};
 
-        if (!requestQ.empty()) {
-            Request r = requestQ.front();
-            requestQ.pop();
-            return r;
+struct WireAssignment {
+    uint32_t id;
+    int16_t car; // as returned by Building::addRequest, or wireRejected
+    uint16_t reserved = 0;
+};
+
+constexpr int16_t wireRejected = -2; // floor out of range or source == destination
+static_assert(sizeof(WireCall) == 8 && sizeof(WireAssignment) == 8, "wire records are packed");
+static_assert(endian::native == endian::little, "wire records are little-endian");
+
+// Single-threaded epoll loop over the listening socket, its connections, a
+// stop eventfd and a signalfd for SIGINT/SIGTERM. Whatever one recv returns is
+// routed as a single addRequests batch and answered before the next wait.
+// A connection with unsent replies is not read again until they drain, so a
+// client that stops reading gets backpressure instead of an unbounded queue.
+class ControlServer {
+public:
+    struct Stats {
+        uint64_t calls = 0;
+        uint64_t rejected = 0;
+        uint64_t connections = 0;
+        LatencyHistogram assign; // call received to its reply queued
+    };
+
+private:
+    struct Connection {
+        int fd;
+        vector<uint8_t> in;
+        size_t have = 0;
+        vector<uint8_t> out;
+        size_t sent = 0;
+
+        explicit Connection(int fd) : fd(fd), in(recvBufferBytes) {}
+    };
+
+    static constexpr size_t recvBufferBytes = 64 * 1024;
+    static constexpr int maxEvents = 64;
+
+    Building& building;
+    string unixPath; // unlinked on destruction
+    int listenFd = -1;
+    int epollFd = -1;
+    int stopFd = -1;
+    int signalFd = -1;
+    bool stopping = false;
+    vector<unique_ptr<Connection>> conns; // by fd
+    vector<Request> burst;
+    vector<int> routed;
+    vector<WireAssignment> replies;
+    Stats counters;
+
+    [[noreturn]] static void fail(const string& what) {
+        throw runtime_error("control socket: " + what + ": " + strerror(errno));
+    }
+
+    void watch(int fd, uint32_t events, int op = EPOLL_CTL_ADD) {
+        epoll_event ev{};
+        ev.events = events;
+        ev.data.fd = fd;
+        if (epoll_ctl(epollFd, op, fd, &ev) < 0) fail("epoll_ctl");
+    }
+
+    void listenOn(const string& endpoint, const string& bindAddress) {
+        if (endpoint.rfind("unix:", 0) == 0) {
+            string path = endpoint.substr(5);
+            sockaddr_un addr{};
+            if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+                throw invalid_argument("bad unix socket path: " + path);
+            }
+            listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (listenFd < 0) fail("socket");
+            struct stat st;
+            if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path.c_str()); // stale from a crash
+            addr.sun_family = AF_UNIX;
+            memcpy(addr.sun_path, path.c_str(), path.size());
+            if (bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) < 0) fail("bind " + path);
+            unixPath = path;
+        }
+        else if (endpoint.rfind("tcp:", 0) == 0) {
+            int port = atoi(endpoint.c_str() + 4);
+            if (port <= 0 || port > 65535) throw invalid_argument("bad tcp port: " + endpoint.substr(4));
+            listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (listenFd < 0) fail("socket");
+            int on = 1;
+            setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            if (inet_pton(AF_INET, bindAddress.c_str(), &addr.sin_addr) != 1) {
+                throw invalid_argument("bad IPv4 bind address: " + bindAddress);
+            }
+            addr.sin_port = htons(static_cast<uint16_t>(port));
+            if (bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) < 0) {
+                fail("bind " + bindAddress + ":" + to_string(port));
+            }
         }
         else {
-            return nullopt;
+            throw invalid_argument("control endpoint must be unix:PATH or tcp:PORT");
+        }
+        if (listen(listenFd, SOMAXCONN) < 0) fail("listen");
+    }
+
+    void acceptAll() {
+        for (;;) {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+                fail("accept");
+            }
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on); // fails harmlessly on Unix sockets
+            if (conns.size() <= static_cast<size_t>(fd)) conns.resize(fd + 1);
+            conns[fd] = make_unique<Connection>(fd);
+            watch(fd, EPOLLIN);
+            counters.connections++;
+        }
+    }
+
+    void closeAll() {
+        for (int fd : { listenFd, epollFd, stopFd, signalFd }) {
+            if (fd >= 0) close(fd);
+        }
+        listenFd = epollFd = stopFd = signalFd = -1;
+        if (!unixPath.empty()) unlink(unixPath.c_str());
+    }
+
+    void drop(Connection& c) {
+        int fd = c.fd;
+        close(fd); // also removes it from the epoll set
+        conns[fd].reset();
+    }
+
+    // Routes every whole record in the buffer as one batch and queues the replies
+    void dispatch(Connection& c, chrono::steady_clock::time_point received) {
+        size_t whole = c.have - c.have % sizeof(WireCall);
+        SimTime now = building.clock().now();
+        burst.clear();
+        replies.clear();
+        for (size_t off = 0; off < whole; off += sizeof(WireCall)) {
+            WireCall w;
+            memcpy(&w, c.in.data() + off, sizeof w);
+            bool valid = w.sourceFloor >= 1 && w.sourceFloor <= building.floors() && w.destFloor >= 1 &&
+                         w.destFloor <= building.floors() && w.sourceFloor != w.destFloor;
+            replies.push_back({ w.id, valid ? int16_t(0) : wireRejected });
+            if (valid) burst.push_back({ w.sourceFloor, w.destFloor, now });
+            else counters.rejected++;
+        }
+        building.addRequests(burst, &routed);
+        for (size_t i = 0, j = 0; i < replies.size(); i++) {
+            if (replies[i].car != wireRejected) replies[i].car = static_cast<int16_t>(routed[j++]);
+        }
+        size_t at = c.out.size();
+        c.out.resize(at + replies.size() * sizeof(WireAssignment));
+        memcpy(c.out.data() + at, replies.data(), replies.size() * sizeof(WireAssignment));
+
+        SimDuration took = chrono::steady_clock::now() - received;
+        for (size_t i = 0; i < replies.size(); i++) counters.assign.record(took);
+        counters.calls += replies.size();
+        memmove(c.in.data(), c.in.data() + whole, c.have - whole);
+        c.have -= whole;
+    }
+
+    // Returns false if the connection was closed
+    bool readFrom(Connection& c) {
+        for (;;) {
+            ssize_t n = recv(c.fd, c.in.data() + c.have, c.in.size() - c.have, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+            if (n <= 0) {
+                drop(c);
+                return false;
+            }
+            c.have += static_cast<size_t>(n);
+            dispatch(c, chrono::steady_clock::now());
+            if (c.out.size() > c.sent) return true; // reply first
+        }
+    }
+
+    // Sends queued replies; switches the connection between reading and
+    // writing so only one direction is watched at a time
+    void flush(Connection& c, bool wasWriting) {
+        while (c.sent < c.out.size()) {
+            ssize_t n = send(c.fd, c.out.data() + c.sent, c.out.size() - c.sent, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                if (!wasWriting) watch(c.fd, EPOLLOUT, EPOLL_CTL_MOD);
+                return;
+            }
+            if (n < 0) {
+                drop(c);
+                return;
+            }
+            c.sent += static_cast<size_t>(n);
+        }
+        c.out.clear();
+        c.sent = 0;
+        if (wasWriting) watch(c.fd, EPOLLIN, EPOLL_CTL_MOD);
+    }
+
+public:
+    // endpoint is "unix:PATH" or "tcp:PORT"; a TCP port listens on bindAddress
+    // only, loopback unless the caller asks otherwise, since calls are not
+    // authenticated
+    ControlServer(Building& b, const string& endpoint, const string& bindAddress = "127.0.0.1") : building(b) {
+        try {
+            listenOn(endpoint, bindAddress);
+            epollFd = epoll_create1(EPOLL_CLOEXEC);
+            if (epollFd < 0) fail("epoll_create1");
+            stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (stopFd < 0) fail("eventfd");
+            sigset_t mask;
+            sigemptyset(&mask);
+            sigaddset(&mask, SIGINT);
+            sigaddset(&mask, SIGTERM);
+            signalFd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+            if (signalFd < 0) fail("signalfd");
+            watch(listenFd, EPOLLIN);
+            watch(stopFd, EPOLLIN);
+            watch(signalFd, EPOLLIN);
+        }
+        catch (...) {
+            closeAll();
+            throw;
+        }
+    }
+
+    ~ControlServer() { closeAll(); }
+
+    ControlServer(const ControlServer&) = delete;
+    ControlServer& operator=(const ControlServer&) = delete;
+
+    // SIGINT/SIGTERM only reach the signalfd if every thread has them blocked,
+    // so call this before starting any
+    static void blockStopSignals() {
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGINT);
+        sigaddset(&mask, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+    }
+
+    // Serves until stop() or a stop signal; open connections are closed on return
+    void run() {
+        epoll_event events[maxEvents];
+        while (!stopping) {
+            int n = epoll_wait(epollFd, events, maxEvents, -1);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                fail("epoll_wait");
+            }
+            for (int i = 0; i < n; i++) {
+                int fd = events[i].data.fd;
+                uint32_t ev = events[i].events;
+                if (fd == listenFd) acceptAll();
+                else if (fd == stopFd || fd == signalFd) stopping = true;
+                else if (static_cast<size_t>(fd) < conns.size() && conns[fd]) {
+                    Connection& c = *conns[fd];
+                    bool writing = c.sent < c.out.size();
+                    if (writing) {
+                        if (ev & (EPOLLOUT | EPOLLERR | EPOLLHUP)) flush(c, true);
+                    }
+                    else if (readFrom(c)) {
+                        flush(c, false);
+                    }
+                }
+            }
         }
+        for (auto& c : conns) {
+            if (c) drop(*c);
+        }
+    }
+
+    // Safe from any thread
+    void stop() {
+        uint64_t one = 1;
+        [[maybe_unused]] ssize_t n = write(stopFd, &one, sizeof one);
     }
+
+    const Stats& stats() const { return counters; }
 };
 
-// Elevator member function definitions
-void Elevator::log(const string& msg) {
-    lock_guard<mutex> lk(logMtx);
-    cout << "[E" << id << "] " << msg << endl;
+void printControlStats(const ControlServer::Stats& s) {
+    cout << "Control plane: " << s.calls << " calls (" << s.rejected << " rejected) over "
+         << s.connections << " connections" << endl;
+    if (s.assign.count() > 0) {
+        cout << fixed << setprecision(0) << "  assignment (us): p50 " << 1000 * s.assign.percentileMs(0.5)
+             << ", p99 " << 1000 * s.assign.percentileMs(0.99) << ", max " << 1000 * s.assign.maxMs() << endl;
+        cout.unsetf(ios::floatfield);
+    }
 }
+#endif
 
-void Elevator::moveTo(int target) {
-    while (currentFloor != target) {
-        this_thread::sleep_for(chrono::milliseconds(200));
-        currentFloor += (target > currentFloor) ? 1 : -1;
-        log("Passing floor " + to_string(currentFloor));
+#ifdef SMART_ELEVATOR_BENCH
+// Queue microbenchmark: producer threads call addRequest while consumer
+// threads drain with waitForRequest, exercising only the queue and wakeups.
+// Returns requests handed over per second of wall time.
+double benchmarkQueue(QueueMode queueMode, int producers, int consumers, int requestsPerProducer) {
+    RealTimeClock clock;
+    Building b(consumers, 10, clock, DispatchMode::Fifo, queueMode);
+    atomic<long long> consumed{ 0 };
+
+    auto start = chrono::steady_clock::now();
+    vector<thread> threads;
+    for (int c = 0; c < consumers; c++) {
+        threads.emplace_back([&, c] {
+            while (b.waitForRequest(c)) consumed.fetch_add(1, memory_order_relaxed);
+        });
+    }
+    vector<thread> prods;
+    for (int p = 0; p < producers; p++) {
+        prods.emplace_back([&] {
+            Request r = { 1, 2, clock.now() };
+            for (int i = 0; i < requestsPerProducer; i++) b.addRequest(r);
+        });
+    }
+    for (auto& t : prods) t.join();
+    b.stopAcceptingRequests();
+    for (auto& t : threads) t.join();
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (consumed != static_cast<long long>(producers) * requestsPerProducer) {
+        throw logic_error("queue benchmark lost requests");
     }
+    return consumed / secs;
 }
 
-void Elevator::process(const Request& r) {
-    moveTo(r.sourceFloor);
-    log("Pick up at " + to_string(r.sourceFloor));
-    moveTo(r.destFloor);
-    log("Drop off at " + to_string(r.destFloor));
-    auto end = chrono::steady_clock::now();
-    auto ms = chrono::duration_cast<chrono::milliseconds>(end - r.timestamp).count();
-    log("Request time: " + to_string(ms) + " ms");
+void runQueueBenchmark() {
+    const int requestsPerProducer = 200000;
+    cout << "producers consumers      mutex+cv      lock-free  (requests/s)" << endl;
+    for (int producers : { 1, 2, 4 }) {
+        for (int consumers : { 1, 2, 4, 8 }) {
+            double shared = benchmarkQueue(QueueMode::Shared, producers, consumers, requestsPerProducer);
+            double lockFree = benchmarkQueue(QueueMode::LockFree, producers, consumers, requestsPerProducer);
+            cout << setw(9) << producers << setw(10) << consumers << fixed << setprecision(0)
+                 << setw(14) << shared << setw(15) << lockFree << endl;
+        }
+    }
+    cout.unsetf(ios::floatfield);
 }
 
-void Elevator::run() {
-    while (running) {
-        auto req = building->waitForRequest();
-        if (!req) break;
-        process(*req);
+// Fleet scoring microbenchmark: the scalar loop against the kernel chosen for
+// this CPU over random fleet states, checking both pick the same car
+void runScoringBenchmark() {
+    const FleetKernel& fast = fleetKernel();
+    const FleetKernel slow = scalarFleetKernel();
+    const int floors = 100;
+    Xoshiro256 rng(1);
+    auto pick = [&](int lo, int hi) { return lo + static_cast<int>(rng() % static_cast<uint64_t>(hi - lo + 1)); };
+
+    cout << "  cars   scalar ns/call   " << setw(6) << fast.name << " ns/call   speedup" << endl;
+    for (int cars : { 8, 16, 32, 128, 512, 2048, 8192 }) {
+        FleetTable f(cars);
+        for (int i = 0; i < cars; i++) {
+            f.floor[i] = pick(1, floors);
+            f.direction[i] = pick(-1, 1);
+            f.target[i] = f.direction[i] > 0 ? pick(f.floor[i], floors) : f.direction[i] < 0 ? pick(1, f.floor[i]) : f.floor[i];
+            f.load[i] = f.direction[i] != 0 ? pick(1, 12) : 0;
+        }
+        vector<pair<int32_t, int32_t>> calls(1024);
+        for (auto& c : calls) c = { pick(1, floors), pick(0, 1) ? 1 : -1 };
+
+        const int rounds = max(1, (1 << 24) / (cars * static_cast<int>(calls.size())));
+        auto time = [&](const FleetKernel& k, vector<int>& picks) {
+            picks.clear();
+            auto start = chrono::steady_clock::now();
+            for (int round = 0; round < rounds; round++) {
+                for (auto [src, dir] : calls) picks.push_back(k.score(f, src, dir, travelCostUnits, stopCostUnits));
+            }
+            return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / picks.size();
+        };
+        vector<int> slowPicks, fastPicks;
+        double slowNs = time(slow, slowPicks);
+        double fastNs = time(fast, fastPicks);
+        if (slowPicks != fastPicks) throw logic_error(string(fast.name) + " kernel disagrees with scalar scoring");
+        cout << setw(6) << cars << fixed << setprecision(1) << setw(17) << slowNs << setw(17) << fastNs
+             << setw(9) << setprecision(2) << slowNs / fastNs << "x" << endl;
     }
+    cout.unsetf(ios::floatfield);
 }
 
-Elevator::Elevator(int id, Building* b) : id(id), building(b) {}
+#ifdef __linux__
+// Control-plane round trip: a client streams calls over a Unix socket to a
+// ControlServer in this process and times each reply. The cars are never
+// started, so this measures the socket, decode and ETA routing path alone.
+void runControlBenchmark() {
+    const int callsPerRow = 5000;
+    RealTimeClock clock;
+    Building b(16, 50, clock, DispatchMode::Eta);
+    string path = "/tmp/smart_elevator_bench." + to_string(getpid()) + ".sock";
+    ControlServer server(b, "unix:" + path);
+    thread loop([&] { server.run(); });
 
-Elevator::~Elevator() {
-    if (thr.joinable()) {
-        thr.join();
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size());
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) < 0) {
+        server.stop();
+        loop.join();
+        throw runtime_error("cannot connect to " + path);
+    }
+
+    cout << "    target     achieved     p50 us     p99 us     max us" << endl;
+    Xoshiro256 rng(1);
+    uint32_t id = 0;
+    for (double rate : { 1000.0, 5000.0, 0.0 }) { // 0: back to back
+        LatencyHistogram rtt;
+        auto start = chrono::steady_clock::now();
+        for (int i = 0; i < callsPerRow; i++) {
+            if (rate > 0) this_thread::sleep_until(start + chrono::duration<double>(i / rate));
+            uint16_t src = static_cast<uint16_t>(1 + rng() % 50);
+            WireCall call{ id++, src, static_cast<uint16_t>(src % 50 + 1) };
+            WireAssignment reply;
+            auto sent = chrono::steady_clock::now();
+            if (send(fd, &call, sizeof call, MSG_NOSIGNAL) != sizeof call ||
+                recv(fd, &reply, sizeof reply, MSG_WAITALL) != sizeof reply || reply.id != call.id) {
+                close(fd);
+                server.stop();
+                loop.join();
+                throw runtime_error("control benchmark lost a reply");
+            }
+            rtt.record(chrono::steady_clock::now() - sent);
+        }
+        double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << fixed << setprecision(0) << setw(10);
+        if (rate > 0) cout << rate;
+        else cout << "max";
+        cout << setw(13) << callsPerRow / secs << setw(11) << 1000 * rtt.percentileMs(0.5) << setw(11)
+             << 1000 * rtt.percentileMs(0.99) << setw(11) << 1000 * rtt.maxMs() << endl;
     }
+    cout.unsetf(ios::floatfield);
+    close(fd);
+    server.stop();
+    loop.join();
+    printControlStats(server.stats());
 }
+#endif
 
-void Elevator::start() {
-    thr = thread(&Elevator::run, this);
+// Benchmark harness (built as smart_elevator_bench): sweeps fleet size, floor
+// count, arrival rate and dispatcher over virtual-time runs. Each
+// configuration runs in a forked child so its wall time and peak RSS are its own.
+struct BenchResult {
+    int elevators;
+    int floors;
+    double rate;
+    DispatchMode dispatch;
+    uint64_t served;
+    double wallSeconds;
+    double simSeconds;
+    long peakRssKb;
+    LatencySummary wait, ride;
+    double meanUtilization;
+    double stopsPerRequest;
+    double whPerPassenger; // 0 without --motion
+};
+
+const char* dispatchName(DispatchMode m) {
+    return m == DispatchMode::Scan ? "scan" : m == DispatchMode::Eta ? "eta"
+         : m == DispatchMode::Destination ? "destination" : "fifo";
 }
 
-void Elevator::stop() {
-    running = false;
-    building->stopAcceptingRequests(); // Ensure wake up
-    if (thr.joinable()) {
-        thr.join();
+BenchResult runBenchConfig(const SimConfig& cfg) {
+    SyntheticSource source(cfg.traffic, cfg.requests, cfg.floors, cfg.seed);
+    auto start = chrono::steady_clock::now();
+    RunReport r = runVirtual(cfg, source);
+    double wall = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    double util = 0;
+    for (double u : r.utilization) util += u;
+
+    return { cfg.elevators, cfg.floors, cfg.traffic.ratePerSecond, cfg.dispatch, r.served, wall, r.simSeconds,
+             ru.ru_maxrss, r.wait, r.ride, r.utilization.empty() ? 0 : util / r.utilization.size(),
+             r.served ? static_cast<double>(r.stops) / r.served : 0, r.served ? 1000 * r.energyKwh / r.served : 0 };
+}
+
+// Runs the configuration in a child process and reads its result back over a pipe
+optional<BenchResult> runBenchIsolated(const SimConfig& cfg) {
+    int fds[2];
+    if (pipe(fds) != 0) return nullopt;
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return nullopt;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        BenchResult res = runBenchConfig(cfg);
+        ssize_t written = write(fds[1], &res, sizeof(res));
+        _exit(written == static_cast<ssize_t>(sizeof(res)) ? 0 : 1);
     }
+    close(fds[1]);
+    BenchResult res;
+    ssize_t got = read(fds[0], &res, sizeof(res));
+    close(fds[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (got != static_cast<ssize_t>(sizeof(res)) || !WIFEXITED(status) || WEXITSTATUS(status) != 0) return nullopt;
+    return res;
 }
 
-// Request generator
-void requestGenerator(Building& b, int numRequests, int maxFloor) {
-    for (int i = 0; i < numRequests; ++i) {
-        int source = rand() % maxFloor + 1;
-        int dest = rand() % maxFloor + 1;
-        while (dest == source) dest = rand() % maxFloor + 1;
-        Request r = { source, dest, chrono::steady_clock::now() };
-        b.addRequest(r);
-        this_thread::sleep_for(chrono::seconds(1));
+void writeCsv(ostream& out, const vector<BenchResult>& results) {
+    out << "elevators,floors,rate,dispatch,served,wall_s,sim_s,requests_per_wall_s,peak_rss_kb,"
+           "wait_mean_ms,wait_p50_ms,wait_p90_ms,wait_p99_ms,wait_max_ms,"
+           "ride_mean_ms,ride_p50_ms,ride_p90_ms,ride_p99_ms,ride_max_ms,utilization,stops_per_request,wh_per_passenger\n";
+    for (auto& r : results) {
+        out << r.elevators << ',' << r.floors << ',' << r.rate << ',' << dispatchName(r.dispatch) << ','
+            << r.served << ',' << r.wallSeconds << ',' << r.simSeconds << ',' << r.served / r.wallSeconds << ','
+            << r.peakRssKb;
+        for (const LatencySummary* l : { &r.wait, &r.ride }) {
+            out << ',' << l->meanMs << ',' << l->p50Ms << ',' << l->p90Ms << ',' << l->p99Ms << ',' << l->maxMs;
+        }
+        out << ',' << r.meanUtilization << ',' << r.stopsPerRequest << ',' << r.whPerPassenger << '\n';
     }
-    b.stopAcceptingRequests();
 }
 
-int main() {
-    srand(static_cast<unsigned int>(time(nullptr)));
-    const int numElevators = 2;
-    const int numFloors = 10;
-    const int numRequests = 10;
+void writeJson(ostream& out, const vector<BenchResult>& results) {
+    auto latency = [&](const LatencySummary& l) {
+        out << "{\"mean_ms\": " << l.meanMs << ", \"p50_ms\": " << l.p50Ms << ", \"p90_ms\": " << l.p90Ms
+            << ", \"p99_ms\": " << l.p99Ms << ", \"max_ms\": " << l.maxMs << "}";
+    };
+    out << "[\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        auto& r = results[i];
+        out << "  {\"elevators\": " << r.elevators << ", \"floors\": " << r.floors << ", \"rate\": " << r.rate
+            << ", \"dispatch\": \"" << dispatchName(r.dispatch) << "\", \"served\": " << r.served
+            << ", \"wall_s\": " << r.wallSeconds << ", \"sim_s\": " << r.simSeconds
+            << ", \"requests_per_wall_s\": " << r.served / r.wallSeconds << ", \"peak_rss_kb\": " << r.peakRssKb
+            << ", \"wait\": ";
+        latency(r.wait);
+        out << ", \"ride\": ";
+        latency(r.ride);
+        out << ", \"utilization\": " << r.meanUtilization << ", \"stops_per_request\": " << r.stopsPerRequest
+            << ", \"wh_per_passenger\": " << r.whPerPassenger << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "]\n";
+}
+
+template <typename T>
+bool parseList(const string& s, vector<T>& out) {
+    out.clear();
+    stringstream ss(s);
+    string item;
+    while (getline(ss, item, ',')) {
+        T v{};
+        auto r = from_chars(item.data(), item.data() + item.size(), v);
+        if (r.ec != errc() || r.ptr != item.data() + item.size() || v <= 0) return false;
+        out.push_back(v);
+    }
+    return !out.empty();
+}
+
+void printBenchUsage(const char* prog) {
+    cerr << "Usage: " << prog << " [options]\n"
+         << "  --elevators LIST --floors LIST   comma-separated sweep values\n"
+         << "  --rates LIST                     arrival rates (calls/s, Poisson)\n"
+         << "  --dispatch LIST                  any of fifo,scan,eta,destination\n"
+         << "  --requests N --seed N            per-run request count and RNG seed\n"
+         << "  --capacity N --board-time MS --alight-time MS   car limits (see smart_elevator)\n"
+         << "  --door-open MS --door-close MS --motion SPEED:ACCEL[:JERK] --floor-height M\n"
+         << "                                   door and travel model; --motion adds energy per passenger\n"
+         << "  --profile uniform|uppeak|downpeak --queue shared|local|lockfree\n"
+         << "  --format csv|json --out FILE     results (default CSV on stdout)\n"
+         << "  --queue-microbench               mutex+cv vs lock-free queue ops/s instead\n"
+         << "  --scoring-microbench             scalar vs SIMD ETA fleet scoring instead\n"
+         << "  --control-microbench             hall-call round trips over the control socket instead" << endl;
+}
+
+int main(int argc, char* argv[]) {
+    vector<int> elevators = { 2, 8, 32 };
+    vector<int> floors = { 10, 50 };
+    vector<double> rates = { 0.5, 2 };
+    vector<DispatchMode> dispatchers = { DispatchMode::Fifo, DispatchMode::Scan, DispatchMode::Eta,
+                                         DispatchMode::Destination };
+    SimConfig base;
+    base.requests = 100000;
+    base.seed = 1;
+    base.virtualTime = true;
+    base.traffic.arrivals = ArrivalProcess::Poisson;
+    string format = "csv", outPath;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        string next = i + 1 < argc ? argv[i + 1] : "";
+        bool ok = true;
+        if (arg == "--queue-microbench") {
+            runQueueBenchmark();
+            return 0;
+        }
+        else if (arg == "--scoring-microbench") {
+            runScoringBenchmark();
+            return 0;
+        }
+#ifdef __linux__
+        else if (arg == "--control-microbench") {
+            runControlBenchmark();
+            return 0;
+        }
+#endif
+        else if (arg == "--elevators") ok = parseList(next, elevators);
+        else if (arg == "--floors") ok = parseList(next, floors) && *min_element(floors.begin(), floors.end()) >= 2;
+        else if (arg == "--rates") ok = parseList(next, rates);
+        else if (arg == "--requests") ok = (base.requests = atoll(next.c_str())) > 0;
+        else if (arg == "--seed") ok = (base.seed = strtoull(next.c_str(), nullptr, 10)) > 0;
+        else if (arg == "--capacity") ok = (base.car.capacity = atoi(next.c_str())) > 0;
+        else if (arg == "--board-time") ok = (base.car.boardTime = chrono::milliseconds(atoi(next.c_str()))) > SimDuration::zero();
+        else if (arg == "--alight-time") ok = (base.car.alightTime = chrono::milliseconds(atoi(next.c_str()))) > SimDuration::zero();
+        else if (arg == "--door-open") ok = (base.car.doorOpenTime = chrono::milliseconds(atoi(next.c_str()))) > SimDuration::zero();
+        else if (arg == "--door-close") ok = (base.car.doorCloseTime = chrono::milliseconds(atoi(next.c_str()))) > SimDuration::zero();
+        else if (arg == "--motion") ok = parseMotion(next, base.car);
+        else if (arg == "--floor-height") ok = (base.car.floorHeight = atof(next.c_str())) > 0;
+        else if (arg == "--dispatch") {
+            dispatchers.clear();
+            stringstream ss(next);
+            string item;
+            while (ok && getline(ss, item, ',')) {
+                if (item == "fifo") dispatchers.push_back(DispatchMode::Fifo);
+                else if (item == "scan") dispatchers.push_back(DispatchMode::Scan);
+                else if (item == "eta") dispatchers.push_back(DispatchMode::Eta);
+                else if (item == "destination") dispatchers.push_back(DispatchMode::Destination);
+                else ok = false;
+            }
+            ok = ok && !dispatchers.empty();
+        }
+        else if (arg == "--profile" && (next == "uniform" || next == "uppeak" || next == "downpeak")) {
+            base.traffic.profile = next == "uppeak" ? TrafficProfile::UpPeak
+                                 : next == "downpeak" ? TrafficProfile::DownPeak : TrafficProfile::Uniform;
+        }
+        else if (arg == "--queue" && (next == "shared" || next == "local" || next == "lockfree")) {
+            base.queue = next == "local" ? QueueMode::Local : next == "lockfree" ? QueueMode::LockFree : QueueMode::Shared;
+        }
+        else if (arg == "--format" && (next == "csv" || next == "json")) format = next;
+        else if (arg == "--out" && !next.empty()) outPath = next;
+        else ok = false;
+
+        if (!ok) {
+            printBenchUsage(argv[0]);
+            return 1;
+        }
+        i++;
+    }
+
+    AsyncLogger::instance().setLevel(LogLevel::Off);
+    vector<BenchResult> results;
+    for (int e : elevators) {
+        for (int f : floors) {
+            for (double rate : rates) {
+                for (DispatchMode d : dispatchers) {
+                    if (d == DispatchMode::Scan && base.queue == QueueMode::LockFree) continue;
+                    SimConfig cfg = base;
+                    cfg.elevators = e;
+                    cfg.floors = f;
+                    cfg.traffic.ratePerSecond = rate;
+                    cfg.dispatch = d;
+                    auto r = runBenchIsolated(cfg);
+                    if (!r) {
+                        cerr << "run failed: " << e << " cars, " << f << " floors, rate " << rate << ", "
+                             << dispatchName(d) << endl;
+                        return 1;
+                    }
+                    cerr << fixed << setprecision(2) << e << " cars, " << f << " floors, rate " << rate << ", "
+                         << dispatchName(d) << ": " << r->wallSeconds << " s wall, wait p99 " << r->wait.p99Ms
+                         << " ms, " << r->stopsPerRequest << " stops/request";
+                    if (r->whPerPassenger > 0) cerr << ", " << r->whPerPassenger << " Wh/passenger";
+                    cerr << endl;
+                    results.push_back(*r);
+                }
+            }
+        }
+    }
+
+    ofstream file;
+    if (!outPath.empty()) {
+        file.open(outPath);
+        if (!file) {
+            cerr << "cannot write " << outPath << endl;
+            return 1;
+        }
+    }
+    ostream& out = outPath.empty() ? cout : file;
+    if (format == "json") writeJson(out, results);
+    else writeCsv(out, results);
+    return 0;
+}
+#else
+
+void printUsage(const char* prog) {
+    cerr << "Usage: " << prog << " [options]\n"
+         << "  --realtime | --virtual            wall-clock threads (default) or virtual-time event loop\n"
+         << "  --elevators N --floors N --requests N\n"
+         << "  --dispatch fifo|scan|eta|destination\n"
+         << "                                    how cars pick up calls\n"
+         << "  --queue shared|local|lockfree     where FIFO/SCAN calls wait\n"
+         << "  --capacity N                      passengers per car (default unlimited)\n"
+         << "  --board-time MS --alight-time MS  door dwell per passenger (default 0)\n"
+         << "  --door-open MS --door-close MS    door dwell per stop (default 0)\n"
+         << "  --motion SPEED:ACCEL[:JERK]       kinematic travel in m/s, m/s^2, m/s^3 (default 200 ms per floor)\n"
+         << "  --floor-height M                  storey height for --motion (default 3.5)\n"
+         << "  --profile uniform|uppeak|downpeak traffic shape\n"
+         << "  --arrivals fixed|poisson --rate R calls per second (default fixed, 1/s)\n"
+         << "  --hot-floor F:W                   make floor F W times as likely (repeatable)\n"
+         << "  --seed N                          RNG seed for reproducible runs\n"
+         << "  --trace FILE                      replay '<time_s> <source> <dest>' lines instead\n"
+         << "  --zones TOP:CARS,...              zoned tower: banks up to each TOP floor, sky lobbies between (virtual)\n"
+         << "  --transfer-time MS                sky-lobby walk between zones (default 20000)\n"
+         << "  --preposition BUCKET_S[:PERIOD_S] park idle cars where demand per bucket of the period (default a day) peaks\n"
+         << "  --snapshot FILE --snapshot-at S   checkpoint the virtual run at simulated time S\n"
+         << "  --restore FILE [--fork-seed N]    resume a virtual run from a checkpoint, optionally reseeded\n"
+         << "  --serve unix:PATH|tcp:PORT        take hall calls from controllers on a socket until SIGINT\n"
+         << "  --control-bind ADDR               IPv4 address for --serve tcp: (default 127.0.0.1)\n"
+         << "  --drain-deadline MS               stop serving this long after intake closes (default never)\n"
+         << "  --metrics FILE [--metrics-interval MS]\n"
+         << "                                    rewrite FILE with lock, wakeup, queue and idle counters (wall clock)\n"
+         << "  --exec threads|coroutines         wall-clock cars as threads or coroutines on --workers threads\n"
+         << "  --buildings N --workers N         simulate N independent buildings in parallel (virtual)\n"
+         << "  --size-fleet P95_S                find the fewest cars whose p95 wait meets P95_S (virtual)\n"
+         << "  --fleet-range MIN:MAX --trials N  car counts to try and seeded trials per count\n"
+         << "  --profiles uniform,uppeak,...     traffic profiles to size for (default --profile)\n"
+         << "  --event-log FILE                  write calls and car events to a columnar binary log\n"
+         << "  --read-events FILE                summarize an event log and exit\n"
+         << "  --log-level trace|debug|info|off --log-sample N" << endl;
+}
+
+// Returns false on a malformed command line
+bool parseArgs(int argc, char* argv[], SimConfig& cfg) {
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        string next = i + 1 < argc ? argv[i + 1] : "";
+        auto positive = [&](long long& out) {
+            char* end = nullptr;
+            long long v = strtoll(next.c_str(), &end, 10);
+            if (next.empty() || *end != '\0' || v <= 0) return false;
+            out = v;
+            i++;
+            return true;
+        };
+        long long n = 0;
+
+        if (arg == "--virtual") cfg.virtualTime = true;
+        else if (arg == "--realtime") cfg.virtualTime = false;
+        else if (arg == "--elevators" && positive(n)) cfg.elevators = static_cast<int>(n);
+        else if (arg == "--floors" && positive(n) && n >= 2) cfg.floors = static_cast<int>(n);
+        else if (arg == "--requests" && positive(n)) cfg.requests = n;
+        else if (arg == "--seed" && positive(n)) cfg.seed = static_cast<uint64_t>(n);
+        else if (arg == "--log-sample" && positive(n)) cfg.logSample = static_cast<uint32_t>(n);
+        else if (arg == "--capacity" && positive(n)) cfg.car.capacity = static_cast<int>(n);
+        else if (arg == "--board-time" && positive(n)) cfg.car.boardTime = chrono::milliseconds(n);
+        else if (arg == "--alight-time" && positive(n)) cfg.car.alightTime = chrono::milliseconds(n);
+        else if (arg == "--door-open" && positive(n)) cfg.car.doorOpenTime = chrono::milliseconds(n);
+        else if (arg == "--door-close" && positive(n)) cfg.car.doorCloseTime = chrono::milliseconds(n);
+        else if (arg == "--motion" && parseMotion(next, cfg.car)) i++;
+        else if (arg == "--floor-height" && atof(next.c_str()) > 0) {
+            cfg.car.floorHeight = atof(next.c_str());
+            i++;
+        }
+        else if (arg == "--buildings" && positive(n)) cfg.buildings = static_cast<int>(n);
+        else if (arg == "--workers" && positive(n)) cfg.workers = static_cast<int>(n);
+        else if (arg == "--drain-deadline" && positive(n)) cfg.drainDeadline = chrono::milliseconds(n);
+        else if (arg == "--dispatch" && (next == "fifo" || next == "scan" || next == "eta" || next == "destination")) {
+            cfg.dispatch = next == "scan" ? DispatchMode::Scan : next == "eta" ? DispatchMode::Eta
+                         : next == "destination" ? DispatchMode::Destination : DispatchMode::Fifo;
+            i++;
+        }
+        else if (arg == "--queue" && (next == "shared" || next == "local" || next == "lockfree")) {
+            cfg.queue = next == "local" ? QueueMode::Local : next == "lockfree" ? QueueMode::LockFree : QueueMode::Shared;
+            i++;
+        }
+        else if (arg == "--profile" && (next == "uniform" || next == "uppeak" || next == "downpeak")) {
+            cfg.traffic.profile = next == "uppeak" ? TrafficProfile::UpPeak
+                                : next == "downpeak" ? TrafficProfile::DownPeak : TrafficProfile::Uniform;
+            i++;
+        }
+        else if (arg == "--exec" && (next == "threads" || next == "coroutines")) {
+            cfg.exec = next == "coroutines" ? ExecutionMode::Coroutines : ExecutionMode::Threads;
+            i++;
+        }
+        else if (arg == "--arrivals" && (next == "fixed" || next == "poisson")) {
+            cfg.traffic.arrivals = next == "poisson" ? ArrivalProcess::Poisson : ArrivalProcess::Fixed;
+            i++;
+        }
+        else if (arg == "--rate" && atof(next.c_str()) > 0) {
+            cfg.traffic.ratePerSecond = atof(next.c_str());
+            i++;
+        }
+        else if (arg == "--hot-floor" && next.find(':') != string::npos) {
+            int floor = atoi(next.c_str());
+            double weight = atof(next.c_str() + next.find(':') + 1);
+            if (floor < 1 || weight <= 0) return false;
+            cfg.traffic.hotFloors.push_back({ floor, weight });
+            i++;
+        }
+        else if (arg == "--log-level" && (next == "trace" || next == "debug" || next == "info" || next == "off")) {
+            cfg.logLevel = next == "trace" ? LogLevel::Trace : next == "debug" ? LogLevel::Debug
+                         : next == "info" ? LogLevel::Info : LogLevel::Off;
+            i++;
+        }
+        else if (arg == "--trace" && !next.empty()) {
+            cfg.tracePath = next;
+            i++;
+        }
+        else if (arg == "--zones" && !next.empty()) {
+            // TOP:CARS,... bottom-up; each zone starts at the one below's top floor
+            cfg.zones.clear();
+            int low = 1;
+            for (size_t pos = 0; pos <= next.size();) {
+                size_t end = min(next.find(',', pos), next.size());
+                string item = next.substr(pos, end - pos);
+                size_t colon = item.find(':');
+                int high = atoi(item.c_str());
+                int cars = colon == string::npos ? 0 : atoi(item.c_str() + colon + 1);
+                if (high <= low || cars <= 0) return false;
+                cfg.zones.push_back({ high, cars });
+                low = high;
+                pos = end + 1;
+            }
+            i++;
+        }
+        else if (arg == "--transfer-time" && positive(n)) cfg.transferTime = chrono::milliseconds(n);
+        else if (arg == "--preposition" && atof(next.c_str()) > 0) {
+            // BUCKET_S[:PERIOD_S]
+            auto seconds = [](double s) { return chrono::duration_cast<SimDuration>(chrono::duration<double>(s)); };
+            cfg.prepositionBucket = seconds(atof(next.c_str()));
+            size_t colon = next.find(':');
+            if (colon != string::npos) {
+                double period = atof(next.c_str() + colon + 1);
+                if (period <= 0) return false;
+                cfg.prepositionPeriod = seconds(period);
+            }
+            if (cfg.prepositionPeriod < cfg.prepositionBucket) return false;
+            i++;
+        }
+        else if (arg == "--snapshot" && !next.empty()) {
+            cfg.snapshotPath = next;
+            i++;
+        }
+        else if (arg == "--snapshot-at" && atof(next.c_str()) >= 0 && !next.empty()) {
+            cfg.snapshotAt = chrono::duration_cast<SimDuration>(chrono::duration<double>(atof(next.c_str())));
+            i++;
+        }
+        else if (arg == "--restore" && !next.empty()) {
+            cfg.restorePath = next;
+            i++;
+        }
+        else if (arg == "--fork-seed" && positive(n)) cfg.forkSeed = static_cast<uint64_t>(n);
+        else if (arg == "--serve" && !next.empty()) {
+            cfg.serveEndpoint = next;
+            i++;
+        }
+        else if (arg == "--control-bind" && !next.empty()) {
+            cfg.controlBind = next;
+            i++;
+        }
+        else if (arg == "--metrics" && !next.empty()) {
+            cfg.metricsPath = next;
+            i++;
+        }
+        else if (arg == "--metrics-interval" && positive(n)) cfg.metricsInterval = chrono::milliseconds(n);
+        else if (arg == "--event-log" && !next.empty()) {
+            cfg.eventLogPath = next;
+            i++;
+        }
+        else if (arg == "--read-events" && !next.empty()) {
+            cfg.readEventsPath = next;
+            i++;
+        }
+        else if (arg == "--size-fleet" && atof(next.c_str()) > 0) {
+            cfg.fleetTargetP95Ms = 1000 * atof(next.c_str());
+            i++;
+        }
+        else if (arg == "--fleet-range" && next.find(':') != string::npos) {
+            cfg.fleetMin = atoi(next.c_str());
+            cfg.fleetMax = atoi(next.c_str() + next.find(':') + 1);
+            if (cfg.fleetMin < 1 || cfg.fleetMax < cfg.fleetMin) return false;
+            i++;
+        }
+        else if (arg == "--trials" && positive(n)) cfg.fleetTrials = static_cast<int>(n);
+        else if (arg == "--profiles" && !next.empty()) {
+            cfg.fleetProfiles.clear();
+            for (size_t pos = 0; pos <= next.size();) {
+                size_t end = min(next.find(',', pos), next.size());
+                string item = next.substr(pos, end - pos);
+                if (item != "uniform" && item != "uppeak" && item != "downpeak") return false;
+                cfg.fleetProfiles.push_back(item == "uppeak" ? TrafficProfile::UpPeak
+                                            : item == "downpeak" ? TrafficProfile::DownPeak : TrafficProfile::Uniform);
+                pos = end + 1;
+            }
+            i++;
+        }
+        else return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    SimConfig cfg;
+    if (!parseArgs(argc, argv, cfg)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    if (!cfg.readEventsPath.empty()) {
+        try {
+            printEventLogSummary(cfg.readEventsPath);
+        }
+        catch (const exception& e) {
+            cerr << "Error: " << e.what() << endl;
+            return 1;
+        }
+        return 0;
+    }
+    if (cfg.queue == QueueMode::LockFree && cfg.dispatch == DispatchMode::Scan) {
+        cerr << "--queue lockfree cannot be combined with --dispatch scan" << endl;
+        return 1;
+    }
+    if (cfg.buildings > 1 && (!cfg.virtualTime || !cfg.tracePath.empty())) {
+        cerr << "--buildings needs --virtual and synthetic traffic" << endl;
+        return 1;
+    }
+    if (cfg.fleetTargetP95Ms > 0 && (!cfg.virtualTime || cfg.buildings > 1 || !cfg.zones.empty() ||
+                                     !cfg.tracePath.empty() || !cfg.snapshotPath.empty() ||
+                                     !cfg.restorePath.empty() || !cfg.serveEndpoint.empty())) {
+        cerr << "--size-fleet needs --virtual, synthetic traffic and a single unzoned building" << endl;
+        return 1;
+    }
+    if (!cfg.zones.empty() && (!cfg.virtualTime || cfg.buildings > 1 || !cfg.serveEndpoint.empty())) {
+        cerr << "--zones needs --virtual and a single building" << endl;
+        return 1;
+    }
+    if (!cfg.zones.empty()) cfg.floors = cfg.zones.back().highFloor;
+    bool checkpointing = !cfg.snapshotPath.empty() || !cfg.restorePath.empty();
+    if (checkpointing && (!cfg.virtualTime || cfg.buildings > 1 || !cfg.zones.empty())) {
+        cerr << "--snapshot and --restore need --virtual and a single unzoned building" << endl;
+        return 1;
+    }
+    if (cfg.forkSeed && cfg.restorePath.empty()) {
+        cerr << "--fork-seed only applies with --restore" << endl;
+        return 1;
+    }
+    if (!cfg.eventLogPath.empty() && (cfg.buildings > 1 || !cfg.zones.empty() || cfg.fleetTargetP95Ms > 0)) {
+        cerr << "--event-log records a single building's run" << endl;
+        return 1;
+    }
+    if (!cfg.metricsPath.empty() && cfg.virtualTime) {
+        cerr << "--metrics describes wall-clock threads; drop --virtual" << endl;
+        return 1;
+    }
+    if (!cfg.serveEndpoint.empty() && (cfg.virtualTime || cfg.buildings > 1 || !cfg.tracePath.empty())) {
+        cerr << "--serve runs one wall-clock building and replaces --trace" << endl;
+        return 1;
+    }
+#ifdef __linux__
+    if (!cfg.serveEndpoint.empty()) ControlServer::blockStopSignals(); // before the logger thread starts
+#else
+    if (!cfg.serveEndpoint.empty()) {
+        cerr << "--serve needs Linux (epoll)" << endl;
+        return 1;
+    }
+#endif
+
+    ThreadRegistry::instance().nameThread("main");
+    AsyncLogger& logger = AsyncLogger::instance();
+    logger.setLevel(cfg.logLevel);
+    logger.setSampleEvery(cfg.logSample);
+    EventLog& events = EventLog::instance();
+    auto finishEventLog = [&] {
+        if (cfg.eventLogPath.empty()) return;
+        uint64_t n = events.stop();
+        cout << "Event log: " << n << " events written to " << cfg.eventLogPath << endl;
+    };
+
+    unique_ptr<RequestSource> source;
+    try {
+        if (!cfg.tracePath.empty()) source = make_unique<TraceSource>(cfg.tracePath, cfg.floors);
+        else source = make_unique<SyntheticSource>(cfg.traffic, cfg.requests, cfg.floors, cfg.seed);
 
-    Building b(numElevators, numFloors);
-    b.startElevators();
+        logger.start();
+        if (!cfg.eventLogPath.empty()) events.start(cfg.eventLogPath);
+#ifdef __linux__
+        if (!cfg.serveEndpoint.empty()) {
+            RealTimeClock clock;
+            Building b(cfg.elevators, cfg.floors, clock, cfg.dispatch, cfg.queue);
+            configureBuilding(b, cfg);
+            if (cfg.exec == ExecutionMode::Coroutines) b.useCoroutines(cfg.workers);
+            ControlServer server(b, cfg.serveEndpoint, cfg.controlBind);
+            MetricsExporter metrics(b, cfg.metricsPath, cfg.metricsInterval);
+            b.startElevators();
+            cerr << "Serving hall calls on " << cfg.serveEndpoint << endl;
+            try {
+                if (!cfg.metricsPath.empty()) metrics.start();
+                server.run();
+            }
+            catch (...) {
+                b.shutdown(cfg.drainDeadline); // cars would otherwise wait forever
+                throw;
+            }
+            b.shutdown(cfg.drainDeadline);
+            if (!cfg.metricsPath.empty()) metrics.stop();
+            logger.stop();
+            printReport(b.report());
+            printControlStats(server.stats());
+            finishEventLog();
+            cout << "Simulation completed." << endl;
+            return 0;
+        }
+#endif
+        if (cfg.fleetTargetP95Ms > 0) {
+            logger.setLevel(LogLevel::Off); // thousands of runs; the report is the output
+            FleetSizer sizer(cfg);
+            FleetSizingReport r = sizer.run(cfg.workers);
+            logger.stop();
+            printFleetSizingReport(r);
+        }
+        else if (cfg.buildings > 1) {
+            CampusEngine campus(cfg, cfg.buildings);
+            CampusReport c = campus.run(cfg.workers);
+            logger.stop();
+            printCampusReport(c);
+        }
+        else if (!cfg.zones.empty()) {
+            ZonedTower tower(cfg, *source);
+            TowerReport t = tower.run();
+            logger.stop();
+            printTowerReport(t);
+        }
+        else if (cfg.virtualTime) {
+            RunReport r = runVirtual(cfg, *source);
+            logger.stop();
+            printReport(r);
+            finishEventLog();
+        }
+        else {
+            RealTimeClock clock;
+            Building b(cfg.elevators, cfg.floors, clock, cfg.dispatch, cfg.queue);
+            configureBuilding(b, cfg);
+            if (cfg.exec == ExecutionMode::Coroutines) b.useCoroutines(cfg.workers);
+            MetricsExporter metrics(b, cfg.metricsPath, cfg.metricsInterval);
+            if (!cfg.metricsPath.empty()) metrics.start();
+            b.startElevators();
 
-    thread gen(requestGenerator, ref(b), numRequests, numFloors);
-    gen.join();
+            exception_ptr genError;
+            thread gen([&] {
+                ThreadRegistry::instance().nameThread("generator");
+                try {
+                    requestGenerator(b, *source);
+                }
+                catch (...) {
+                    genError = current_exception();
+                    b.stopAcceptingRequests();
+                }
+            });
+            gen.join();
 
-    b.waitForElevators();
+            b.shutdown(cfg.drainDeadline);
+            if (!cfg.metricsPath.empty()) metrics.stop();
+            if (genError) rethrow_exception(genError);
+            logger.stop();
+            printReport(b.report());
+            finishEventLog();
+        }
+    }
+    catch (const exception& e) {
+        logger.stop();
+        events.halt();
+        cerr << "Error: " << e.what() << endl;
+        return 1;
+    }
 
     cout << "Simulation completed." << endl;
     return 0;
 }
+
+#endif
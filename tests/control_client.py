@@ -0,0 +1,117 @@
+#!/usr/bin/env python3
+# Scripted controller for --serve unix:PATH. Pins the 8-byte little-endian
+# WireCall and WireAssignment layouts, the wireRejected reply, and records
+# that reach the server split across several recv calls.
+#
+#   control_client.py <smart_elevator> <work dir>
+
+import os
+import signal
+import socket
+import struct
+import subprocess
+import sys
+import time
+
+ELEVATORS = 3
+FLOORS = 10
+WIRE_REJECTED = -2
+CALL = struct.Struct("<IHH")        # id, sourceFloor, destFloor
+ASSIGNMENT = struct.Struct("<IhH")  # id, car, reserved
+
+
+def fail(why):
+    sys.exit("control_client: " + why)
+
+
+def recv_exact(sock, n):
+    data = b""
+    while len(data) < n:
+        chunk = sock.recv(n - len(data))
+        if not chunk:
+            fail("server closed the connection after %d of %d bytes" % (len(data), n))
+        data += chunk
+    return data
+
+
+def expect(sock, calls):
+    """Reads one reply per call and checks it echoes the id in order."""
+    for id, source, dest in calls:
+        got_id, car, reserved = ASSIGNMENT.unpack(recv_exact(sock, ASSIGNMENT.size))
+        if got_id != id or reserved != 0:
+            fail("reply %r does not answer call %d" % ((got_id, car, reserved), id))
+        valid = 1 <= source <= FLOORS and 1 <= dest <= FLOORS and source != dest
+        if valid and not 0 <= car < ELEVATORS:
+            fail("call %d was routed to car %d" % (id, car))
+        if not valid and car != WIRE_REJECTED:
+            fail("call %d (%d -> %d) got car %d, not the reject" % (id, source, dest, car))
+
+
+def main():
+    sim, work = sys.argv[1], sys.argv[2]
+    os.makedirs(work, exist_ok=True)
+    path = os.path.join(work, "control.sock")
+    if os.path.exists(path):
+        os.unlink(path)
+    if CALL.size != 8 or ASSIGNMENT.size != 8:
+        fail("wire records must be 8 bytes")
+
+    server = subprocess.Popen([sim, "--serve", "unix:" + path, "--dispatch", "eta", "--elevators", str(ELEVATORS),
+                               "--floors", str(FLOORS), "--log-level", "off"],
+                              stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+    try:
+        sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        sock.settimeout(10)
+        for _ in range(100):
+            try:
+                sock.connect(path)
+                break
+            except (FileNotFoundError, ConnectionRefusedError):
+                time.sleep(0.05)
+        else:
+            fail("server did not listen on " + path)
+
+        calls = []
+
+        # Whole records in one send
+        batch = [(1, 1, 5), (2, 9, 2), (3, 10, 1)]
+        sock.sendall(b"".join(CALL.pack(*c) for c in batch))
+        expect(sock, batch)
+        calls += batch
+
+        # One record a byte at a time, then two records cut across their boundary
+        one = (4, 3, 7)
+        for b in CALL.pack(*one):
+            sock.sendall(bytes([b]))
+            time.sleep(0.02)
+        expect(sock, [one])
+        pair = [(5, 6, 1), (6, 2, 8)]
+        data = CALL.pack(*pair[0]) + CALL.pack(*pair[1])
+        sock.sendall(data[:11])
+        time.sleep(0.05)
+        sock.sendall(data[11:])
+        expect(sock, pair)
+        calls += [one] + pair
+
+        # Each kind of invalid call, mixed with a valid one
+        bad = [(7, 4, 4), (8, 0, 3), (9, 2, FLOORS + 1), (10, 65535, 1), (11, 5, 6)]
+        sock.sendall(b"".join(CALL.pack(*c) for c in bad))
+        expect(sock, bad)
+        calls += bad
+        sock.close()
+    finally:
+        server.send_signal(signal.SIGINT)
+        try:
+            out, _ = server.communicate(timeout=30)
+        except subprocess.TimeoutExpired:
+            server.kill()
+            fail("server did not stop on SIGINT")
+
+    rejected = sum(1 for _, s, d in calls if not (1 <= s <= FLOORS and 1 <= d <= FLOORS and s != d))
+    want = "Control plane: %d calls (%d rejected) over 1 connections" % (len(calls), rejected)
+    if server.returncode != 0 or want not in out:
+        fail("server exited %d without '%s':\n%s" % (server.returncode, want, out))
+
+
+if __name__ == "__main__":
+    main()
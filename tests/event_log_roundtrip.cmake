@@ -0,0 +1,50 @@
+# Event log round trip: --read-events over a log spanning several chunks must
+# print the wait and ride table the run itself printed, and logs cut short
+# must be refused with an error rather than read past their end.
+#
+#   cmake -DSIM=<smart_elevator> -DARGS="<options>" -DWORK=<dir> -P event_log_roundtrip.cmake
+
+separate_arguments(args UNIX_COMMAND "${ARGS}")
+file(MAKE_DIRECTORY "${WORK}")
+set(log "${WORK}/events.log")
+file(REMOVE "${log}")
+
+# The "(ms)" header and the wait and ride rows
+function(latency_table text out)
+    string(REGEX MATCH "  \\(ms\\)[^\n]*\n  wait[^\n]*\n  ride[^\n]*\n" table "${text}")
+    set(${out} "${table}" PARENT_SCOPE)
+endfunction()
+
+execute_process(COMMAND "${SIM}" ${args} --log-level off --event-log "${log}"
+                RESULT_VARIABLE rc OUTPUT_VARIABLE run ERROR_VARIABLE err)
+if(NOT rc EQUAL 0 OR NOT EXISTS "${log}")
+    message(FATAL_ERROR "run failed (${rc}): ${err}")
+endif()
+execute_process(COMMAND "${SIM}" --read-events "${log}" RESULT_VARIABLE rc OUTPUT_VARIABLE read ERROR_VARIABLE err)
+if(NOT rc EQUAL 0)
+    message(FATAL_ERROR "--read-events failed (${rc}): ${err}")
+endif()
+
+if(NOT read MATCHES "events in ([0-9]+) chunks" OR CMAKE_MATCH_1 LESS 2)
+    message(FATAL_ERROR "log should span several chunks:\n${read}")
+endif()
+latency_table("${run}" want)
+latency_table("${read}" got)
+if(want STREQUAL "" OR NOT want STREQUAL got)
+    message(FATAL_ERROR "--read-events differs from the run\n--- run\n${run}--- read\n${read}")
+endif()
+
+# Cut inside the first chunk, mid-log and just short of the end
+file(SIZE "${log}" size)
+math(EXPR mid "${size} / 2")
+math(EXPR near "${size} - 1")
+foreach(cut 12 ${mid} ${near})
+    execute_process(COMMAND head -c ${cut} "${log}" OUTPUT_FILE "${log}.cut" RESULT_VARIABLE rc)
+    if(NOT rc EQUAL 0)
+        message(FATAL_ERROR "cannot cut ${log}")
+    endif()
+    execute_process(COMMAND "${SIM}" --read-events "${log}.cut" RESULT_VARIABLE rc OUTPUT_VARIABLE out ERROR_VARIABLE err)
+    if(NOT rc EQUAL 1 OR NOT err MATCHES "Error: ")
+        message(FATAL_ERROR "log cut to ${cut} bytes was not refused cleanly (${rc}):\n${out}${err}")
+    endif()
+endforeach()
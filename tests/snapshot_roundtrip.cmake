@@ -0,0 +1,54 @@
+# Checkpoint round trip: a run snapshotted at 600 s and restored must print
+# what the same run prints uninterrupted. With CORRUPT set, the snapshot is
+# cut short instead and the restore must fail with an error.
+#
+#   cmake -DSIM=<smart_elevator> -DARGS="<options>" -DWORK=<dir> [-DCORRUPT=ON] -P snapshot_roundtrip.cmake
+
+separate_arguments(args UNIX_COMMAND "${ARGS}")
+file(MAKE_DIRECTORY "${WORK}")
+set(snap "${WORK}/checkpoint.snap")
+file(REMOVE "${snap}")
+
+function(run out)
+    execute_process(COMMAND "${SIM}" ${args} --log-level off ${ARGN}
+                    RESULT_VARIABLE rc OUTPUT_VARIABLE stdout ERROR_VARIABLE stderr)
+    set(${out}_rc "${rc}" PARENT_SCOPE)
+    # Allocation counts differ by what restoring allocates; nothing else may
+    string(REGEX REPLACE "(Heap allocations|Snapshot at)[^\n]*\n" "" stdout "${stdout}")
+    set(${out} "${stdout}" PARENT_SCOPE)
+    set(${out}_err "${stderr}" PARENT_SCOPE)
+endfunction()
+
+run(taken --snapshot-at 600 --snapshot "${snap}")
+if(NOT taken_rc EQUAL 0 OR NOT EXISTS "${snap}")
+    message(FATAL_ERROR "snapshot run failed (${taken_rc}): ${taken_err}")
+endif()
+
+if(CORRUPT)
+    file(SIZE "${snap}" size)
+    math(EXPR half "${size} / 2")
+    execute_process(COMMAND head -c ${half} "${snap}" OUTPUT_FILE "${snap}.cut" RESULT_VARIABLE rc)
+    if(NOT rc EQUAL 0)
+        message(FATAL_ERROR "cannot cut ${snap}")
+    endif()
+    file(WRITE "${WORK}/garbage.snap" "ELEVSNAP is not what this file holds\n")
+    foreach(bad "${snap}.cut" "${WORK}/garbage.snap")
+        run(restored --restore "${bad}")
+        if(restored_rc EQUAL 0 OR NOT restored_err MATCHES "Error: ")
+            message(FATAL_ERROR "restoring ${bad} did not fail cleanly (${restored_rc}):\n${restored}${restored_err}")
+        endif()
+    endforeach()
+    return()
+endif()
+
+run(full)
+run(restored --restore "${snap}")
+if(NOT full_rc EQUAL 0 OR NOT restored_rc EQUAL 0)
+    message(FATAL_ERROR "run failed: ${full_err}${restored_err}")
+endif()
+if(NOT full STREQUAL restored)
+    message(FATAL_ERROR "restored run differs\n--- uninterrupted\n${full}--- restored\n${restored}")
+endif()
+if(NOT full MATCHES "Served [0-9]+ requests")
+    message(FATAL_ERROR "run served nothing:\n${full}")
+endif()